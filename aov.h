@@ -0,0 +1,114 @@
+// Arbitrary output variables, gathered from the primary hit in the same
+// pass as the beauty image and written out as one multi-channel EXR.
+
+struct GBufferSample{
+	glm::vec3 normal, albedo;
+	glm::vec3 direct, reflected;
+	float depth = 0.0f;
+	uint32_t materialID = 0;
+
+	void accumulate(const GBufferSample &s, float weight){
+		normal += s.normal * weight;
+		albedo += s.albedo * weight;
+		direct += s.direct * weight;
+		reflected += s.reflected * weight;
+		depth += s.depth * weight;
+		// IDs can't be averaged, the first sample to hit something wins.
+		if(!materialID) materialID = s.materialID;
+	}
+};
+
+enum AOVFlags{
+	AOVDepth = 1 << 0, AOVNormal = 1 << 1, AOVAlbedo = 1 << 2, AOVMaterialID = 1 << 3,
+	AOVDirect = 1 << 4, AOVReflected = 1 << 5, AOVSampleCount = 1 << 6, AOVAll = (1 << 7) - 1
+};
+
+// Comma separated list such as "depth,normal,material", or "all".
+inline bool parseAOVList(const std::string &list, unsigned &mask){
+	const std::pair<const char*, unsigned> names[] = {
+		{"depth", AOVDepth}, {"normal", AOVNormal}, {"albedo", AOVAlbedo}, {"material", AOVMaterialID},
+		{"direct", AOVDirect}, {"reflected", AOVReflected}, {"samples", AOVSampleCount}, {"all", AOVAll}
+	};
+	size_t start = 0;
+	while(start <= list.size()){
+		size_t end = std::min(list.find(',', start), list.size());
+		std::string item = list.substr(start, end - start);
+		bool found = false;
+		for(auto &n : names)
+			if(item == n.first){ mask |= n.second; found = true; }
+		if(!found) return false;
+		start = end + 1;
+	}
+	return true;
+}
+
+// Material IDs are stored Cryptomatte style: the name hash reinterpreted as a
+// float, nudged away from denormal/inf/nan exponents so that it survives compositing.
+inline float idToFloat(uint32_t id){
+	uint32_t exponent = (id >> 23) & 255;
+	if(exponent == 0 || exponent == 255) id ^= 1u << 23;
+	float f;
+	std::memcpy(&f, &id, 4);
+	return f;
+}
+
+struct AOVBuffers{
+	unsigned mask;
+	int width, height;
+	std::vector<float> color, depth, normal, albedo, materialID, direct, reflected, sampleCount;
+
+	AOVBuffers(unsigned m, int w, int h) : mask(m), width(w), height(h) {
+		size_t n = (size_t)w * h;
+		color.resize(3 * n);
+		if(mask & AOVDepth) depth.resize(n);
+		if(mask & AOVNormal) normal.resize(3 * n);
+		if(mask & AOVAlbedo) albedo.resize(3 * n);
+		if(mask & AOVMaterialID) materialID.resize(n);
+		if(mask & AOVDirect) direct.resize(3 * n);
+		if(mask & AOVReflected) reflected.resize(3 * n);
+		if(mask & AOVSampleCount) sampleCount.resize(n);
+	}
+
+	static void store(std::vector<float> &plane, size_t idx, glm::vec3 v){
+		plane[idx] = v.x; plane[idx + plane.size() / 3] = v.y; plane[idx + 2 * plane.size() / 3] = v.z;
+	}
+
+	void setPixel(int idx, glm::vec3 beauty, const GBufferSample &g, int count){
+		store(color, idx, beauty);
+		if(mask & AOVDepth) depth[idx] = g.depth;
+		if(mask & AOVNormal) store(normal, idx, g.normal);
+		if(mask & AOVAlbedo) store(albedo, idx, g.albedo);
+		if(mask & AOVMaterialID) materialID[idx] = idToFloat(g.materialID);
+		if(mask & AOVDirect) store(direct, idx, g.direct);
+		if(mask & AOVReflected) store(reflected, idx, g.reflected);
+		if(mask & AOVSampleCount) sampleCount[idx] = (float)count;
+	}
+
+	bool write(const char *filename, const std::vector<Material> &materials) const{
+		std::vector<EXRChannel> channels;
+		auto addRGB = [&](const std::string &prefix, const std::vector<float> &plane, const char *x, const char *y, const char *z){
+			size_t n = plane.size() / 3;
+			channels.push_back({prefix + x, plane.data()});
+			channels.push_back({prefix + y, plane.data() + n});
+			channels.push_back({prefix + z, plane.data() + 2 * n});
+		};
+		addRGB("", color, "R", "G", "B");
+		if(mask & AOVDepth) channels.push_back({"Z", depth.data()});
+		if(mask & AOVNormal) addRGB("N.", normal, "X", "Y", "Z");
+		if(mask & AOVAlbedo) addRGB("albedo.", albedo, "R", "G", "B");
+		if(mask & AOVMaterialID) channels.push_back({"materialID", materialID.data()});
+		if(mask & AOVDirect) addRGB("direct.", direct, "R", "G", "B");
+		if(mask & AOVReflected) addRGB("reflected.", reflected, "R", "G", "B");
+		if(mask & AOVSampleCount) channels.push_back({"sampleCount", sampleCount.data()});
+
+		// Name -> ID manifest, so materialID values can be mapped back to names.
+		std::string manifest = "{";
+		for(auto &m : materials){
+			char hex[16];
+			snprintf(hex, sizeof(hex), "%08x", m.id);
+			manifest += (manifest.size() > 1 ? ",\"" : "\"") + m.name + "\":\"" + hex + "\"";
+		}
+		manifest += "}";
+		return writeEXR(filename, width, height, channels, {{"materialManifest", manifest}});
+	}
+};
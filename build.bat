@@ -1 +1,3 @@
-g++ -std=c++17 -Iglm -fopenmp main.cpp
\ No newline at end of file
+g++ -std=c++17 -O2 -fno-math-errno -fno-trapping-math -Iglm -fopenmp -c renderdude.cpp -o renderdude.o
+ar rcs librenderdude.a renderdude.o
+g++ -std=c++17 -O2 -fno-math-errno -fno-trapping-math -Iglm -fopenmp main.cpp librenderdude.a
\ No newline at end of file
@@ -0,0 +1,676 @@
+// Bounding volume hierarchy over the objects that have bounds (spheres);
+// the others (planes) are tested by every ray. Ties between equally close
+// hits go to the lowest object index, so traversal finds what testing every
+// object in scene order does, whatever the tree looks like, bar rays at the
+// edge of the sphere test's precision: it squares the distance from the ray's
+// origin, so from far away it reports hits a little outside the sphere (about
+// 1e-7 distance^2 / radius), which a tree only finds if the ray enters the
+// box for other reasons. Boxes grown to match cost several times the
+// traversal, from rays starting far out on the planes.
+//
+// Lazy builds split the top levels up front and leave the nodes below as
+// unsplit ranges of primitives, split by the first ray to reach them, so rays
+// only ever pay for the parts of the scene they get near. The node array is
+// allocated for the whole tree up front and never moves, and an unsplit
+// node's range belongs to it alone: whoever wins its state splits it while
+// other rays reaching it wait, then publishes the children.
+//
+// Splits (BvhSplit) are made one node at a time, so any of them can be lazy:
+//   median  halves the centroids along their longest axis
+//   sah     binned surface area heuristic, best of 16 planes per axis
+//   morton  primitives sorted by the Morton code of their centroid once, then
+//           each node splits where the highest differing bit flips (an LBVH)
+// The up front part runs on the pool: breadth first with the binning (and
+// the children's bounds) spread over all workers while there are few nodes,
+// then a subtree per worker. The Morton sort's counting passes are split
+// over the workers too.
+//
+// A complete tree can also be traversed as a wide one (BvhLayout): every
+// wide node holds the boxes of up to four nodes a level or two down the
+// binary tree, on an 8 bit grid over its own box, in one cache line, and a
+// ray is tested against all four at once.
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BVH_SSE2 1
+#endif
+
+const int bvhLeafSize = 4;
+const int lazyBvhEagerDepth = 4; // levels split before the first ray
+const int sahBins = 16;
+const int sahMaxDepth = 64;      // median splits below, so traversal's stack is bounded
+const int bvhMaxDepth = 120;     // what traversal's stack holds
+const int bvhParallelBinning = 1 << 16; // primitives in a node worth spreading over the pool
+
+enum BVHNodeState{
+	BVHUnsplit = 0, BVHSplitting = -1, BVHLeaf = -2 // anything above is the first child's index
+};
+
+struct BVHPrimitive{
+	glm::vec3 lo, hi, centroid;
+	int object;
+	uint32_t code; // Morton code, morton splits only
+};
+
+struct BVHNode{
+	glm::vec3 lo, hi;
+	int first = 0, count = 0; // range of primitives under it
+	int axis = 0;             // the children are split along it
+	int depth = 0;
+	std::atomic<int> state{BVHUnsplit};
+};
+
+// Slab test against [0, tMax], giving up on nothing that rounding could put
+// inside: a zero direction component (infinite inverse) that makes a NaN
+// just leaves that slab unchecked.
+inline bool rayHitsBox(glm::vec3 lo, glm::vec3 hi, glm::vec3 orig, glm::vec3 inv, float tMax){
+	float tNear = 0.0f, tFar = tMax * 1.0001f;
+	for(int a = 0; a < 3; a++){
+		float t0 = (lo[a] - orig[a]) * inv[a], t1 = (hi[a] - orig[a]) * inv[a];
+		if(inv[a] < 0.0f) std::swap(t0, t1);
+		tNear = t0 > tNear ? t0 : tNear;
+		tFar = t1 < tFar ? t1 : tFar;
+	}
+	return tNear <= tFar;
+}
+
+inline float halfArea(glm::vec3 lo, glm::vec3 hi){
+	glm::vec3 d = glm::max(hi - lo, glm::vec3(0.0f));
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+// Spreads the low 10 bits of v to every third bit.
+inline uint32_t spreadBits10(uint32_t v){
+	v = (v * 0x00010001u) & 0xff0000ffu;
+	v = (v * 0x00000101u) & 0x0f00f00fu;
+	v = (v * 0x00000011u) & 0xc30c30c3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+// Children of a wide node, each an inner wide node or a leaf's primitives.
+// Child boxes are whole grid steps of 2^exponent from origin (the node's
+// lower corner) and hold their binary node's box; a slot without a child
+// has lo above hi, which no ray enters.
+struct alignas(64) WideBVHNode{
+	glm::vec3 origin;
+	int8_t exponent[3];
+	uint8_t lo[3][4], hi[3][4]; // axis, child
+	int child[4];     // wide node index, or first primitive of a leaf
+	uint8_t count[4]; // a leaf's primitives, 0 for an inner node
+};
+static_assert(sizeof(WideBVHNode) == 64, "a wide node is one cache line");
+
+inline float gridStep(int8_t exponent){
+	return bitsToFloat((uint32_t)(exponent + 127) << 23);
+}
+
+#ifdef BVH_SSE2
+inline __m128 gridToFloats(const uint8_t *q){
+	int32_t packed;
+	memcpy(&packed, q, 4);
+	const __m128i zero = _mm_setzero_si128();
+	return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero));
+}
+#endif
+
+struct SahBin{
+	glm::vec3 lo = glm::vec3(std::numeric_limits<float>::max()), hi = glm::vec3(-std::numeric_limits<float>::max());
+	int count = 0;
+
+	void add(glm::vec3 l, glm::vec3 h, int n){
+		lo = glm::min(lo, l);
+		hi = glm::max(hi, h);
+		count += n;
+	}
+};
+
+struct BVH{
+	const std::vector<Object*> &objects;
+	const BvhBuild build;
+	const BvhSplit splitMethod;
+	std::vector<int> unbounded; // object indices, in scene order
+	// In builtPrimitives and builtNodes, or in storage for a tree loaded
+	// whole (see bvhCache.h).
+	BVHPrimitive *primitives = nullptr;
+	size_t primitiveCount = 0;
+	BVHNode *nodes = nullptr;
+	std::atomic<int> nodeCount{0};
+	std::vector<BVHPrimitive> builtPrimitives;
+	std::unique_ptr<BVHNode[]> builtNodes;
+	std::shared_ptr<const void> storage;
+	BvhLayout layout = BinaryBvh;
+	std::vector<WideBVHNode> wideNodes; // traversed instead if wide
+	float buildSeconds = 0.0f; // the part done before the first ray
+
+	// No tree yet, for loading one.
+	BVH(const std::vector<Object*> &o, BvhBuild b, BvhSplit s) : objects(o), build(b), splitMethod(s) {
+		glm::vec3 lo, hi;
+		for(size_t i = 0; i < objects.size(); i++)
+			if(!objects[i]->bounds(lo, hi)) unbounded.push_back((int)i);
+	}
+
+	// pool, if given, runs the up front part; it mustn't be busy with a job of
+	// this thread's.
+	BVH(const std::vector<Object*> &o, BvhBuild b, BvhSplit s, ThreadPool *pool) : objects(o), build(b), splitMethod(s) {
+		auto start = std::chrono::steady_clock::now();
+		for(size_t i = 0; i < objects.size(); i++){
+			BVHPrimitive p;
+			if(!objects[i]->bounds(p.lo, p.hi)){
+				unbounded.push_back((int)i);
+				continue;
+			}
+			// Padded for the rounding of the objects' own hit tests near the
+			// origin; rays from far off can still miss a hit the sphere test
+			// would report just outside it (see the top of the file).
+			glm::vec3 pad = (glm::abs(p.lo) + glm::abs(p.hi) + (p.hi - p.lo)) * 1e-4f + glm::vec3(1e-6f);
+			p.lo -= pad;
+			p.hi += pad;
+			p.centroid = (p.lo + p.hi) * 0.5f;
+			p.object = (int)i;
+			p.code = 0;
+			builtPrimitives.push_back(p);
+		}
+		primitives = builtPrimitives.data();
+		primitiveCount = builtPrimitives.size();
+		builtNodes.reset(new BVHNode[std::max<size_t>(1, 2 * primitiveCount)]);
+		nodes = builtNodes.get();
+		nodeCount = 1;
+		nodes[0].count = (int)primitiveCount;
+		fitBounds(nodes[0], pool);
+		if(splitMethod == MortonSplit) sortByMortonCode(pool);
+		if(primitiveCount) buildTop(pool, build == LazyBvh ? lazyBvhEagerDepth : std::numeric_limits<int>::max());
+		buildSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Runs fn(first, last) over [first, first + count) in one chunk per
+	// worker, or in one go without a pool.
+	static void forChunks(ThreadPool *pool, int first, int count, const std::function<void(int, int, int)> &fn){
+		if(!pool){
+			fn(0, first, first + count);
+			return;
+		}
+		const int chunks = pool->size();
+		pool->broadcast([&](int worker){
+			fn(worker, first + (int)((int64_t)count * worker / chunks), first + (int)((int64_t)count * (worker + 1) / chunks));
+		});
+	}
+
+	// With a pool, each worker finds the bounds of its own chunk and counts its
+	// codes, then writes its primitives after those of the chunks before it
+	// with the same digit, so the order comes out as a serial sort's.
+	void sortByMortonCode(ThreadPool *pool){
+		if(primitiveCount < (size_t)bvhParallelBinning) pool = nullptr;
+		const int chunks = pool ? pool->size() : 1, count = (int)primitiveCount;
+		std::vector<glm::vec3> chunkLo(chunks), chunkHi(chunks);
+		forChunks(pool, 0, count, [&](int chunk, int first, int last){
+			glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+			for(int i = first; i < last; i++){
+				lo = glm::min(lo, primitives[i].centroid);
+				hi = glm::max(hi, primitives[i].centroid);
+			}
+			chunkLo[chunk] = lo;
+			chunkHi[chunk] = hi;
+		});
+		glm::vec3 lo = chunkLo[0], hi = chunkHi[0];
+		for(int c = 1; c < chunks; c++){
+			lo = glm::min(lo, chunkLo[c]);
+			hi = glm::max(hi, chunkHi[c]);
+		}
+		// Cubic cells, so a flat scene's thin axis isn't split as often as the others.
+		const glm::vec3 extent = hi - lo;
+		const float scale = 1023.0f / std::max(std::max(extent.x, std::max(extent.y, extent.z)), 1e-20f);
+		forChunks(pool, 0, count, [&](int, int first, int last){
+			for(int i = first; i < last; i++){
+				glm::vec3 cell = (primitives[i].centroid - lo) * scale;
+				primitives[i].code = spreadBits10((uint32_t)cell.x) | (spreadBits10((uint32_t)cell.y) << 1) | (spreadBits10((uint32_t)cell.z) << 2);
+			}
+		});
+		// Three stable 10 bit counting passes, ties stay in scene order.
+		std::vector<BVHPrimitive> sorted(primitiveCount);
+		std::vector<int> next(chunks * 1024);
+		for(int shift = 0; shift < 30; shift += 10){
+			const BVHPrimitive *from = builtPrimitives.data();
+			BVHPrimitive *to = sorted.data();
+			forChunks(pool, 0, count, [&](int chunk, int first, int last){
+				int *counts = &next[chunk * 1024];
+				std::fill(counts, counts + 1024, 0);
+				for(int i = first; i < last; i++) counts[(from[i].code >> shift) & 1023]++;
+			});
+			for(int digit = 0, start = 0; digit < 1024; digit++)
+				for(int chunk = 0; chunk < chunks; chunk++){
+					const int n = next[chunk * 1024 + digit];
+					next[chunk * 1024 + digit] = start;
+					start += n;
+				}
+			forChunks(pool, 0, count, [&](int chunk, int first, int last){
+				int *place = &next[chunk * 1024];
+				for(int i = first; i < last; i++) to[place[(from[i].code >> shift) & 1023]++] = from[i];
+			});
+			builtPrimitives.swap(sorted);
+		}
+		primitives = builtPrimitives.data();
+	}
+
+	// Large nodes' bounds are gathered on all of the pool's workers, if given.
+	void fitBounds(BVHNode &node, ThreadPool *pool = nullptr) const{
+		if(pool && node.count >= bvhParallelBinning){
+			std::vector<glm::vec3> chunkLo(pool->size()), chunkHi(pool->size());
+			forChunks(pool, node.first, node.count, [&](int chunk, int first, int last){
+				BVHNode part;
+				part.first = first;
+				part.count = last - first;
+				fitBounds(part);
+				chunkLo[chunk] = part.lo;
+				chunkHi[chunk] = part.hi;
+			});
+			node.lo = chunkLo[0];
+			node.hi = chunkHi[0];
+			for(int c = 1; c < pool->size(); c++){
+				node.lo = glm::min(node.lo, chunkLo[c]);
+				node.hi = glm::max(node.hi, chunkHi[c]);
+			}
+			return;
+		}
+		node.lo = glm::vec3(std::numeric_limits<float>::max());
+		node.hi = glm::vec3(-std::numeric_limits<float>::max());
+		for(int p = node.first; p < node.first + node.count; p++){
+			node.lo = glm::min(node.lo, primitives[p].lo);
+			node.hi = glm::max(node.hi, primitives[p].hi);
+		}
+	}
+
+	// Breadth first while there are fewer nodes than the pool has room for
+	// (each split's binning spread over the pool), then whole subtrees, each
+	// on one worker.
+	void buildTop(ThreadPool *pool, int depth){
+		std::vector<int> frontier(1, 0);
+		int level = 0;
+		for(; pool && level < depth && !frontier.empty() && (int)frontier.size() < 4 * pool->size(); level++){
+			std::vector<int> next;
+			for(int index : frontier){
+				const int left = split(index, pool);
+				if(left){
+					next.push_back(left);
+					next.push_back(left + 1);
+				}
+			}
+			frontier.swap(next);
+		}
+		if(level >= depth) return;
+		std::atomic<size_t> nextTask(0);
+		auto subtrees = [&](int){
+			for(size_t task; (task = nextTask++) < frontier.size();) splitDown(frontier[task], depth - level);
+		};
+		if(pool) pool->broadcast(subtrees);
+		else subtrees(0);
+	}
+
+	// Splits a node and its subtree down to depth more levels, the rest stays
+	// unsplit. Only for nodes no ray can reach yet.
+	void splitDown(int index, int depth){
+		if(depth <= 0) return;
+		int left = split(index, nullptr);
+		if(left > 0){
+			splitDown(left, depth - 1);
+			splitDown(left + 1, depth - 1);
+		}
+	}
+
+	// Splits a node's primitives in two and publishes the children (0 if
+	// it's a leaf). With a pool, large nodes are binned on all its workers.
+	int split(int index, ThreadPool *pool){
+		BVHNode &node = nodes[index];
+		if(node.count <= bvhLeafSize){
+			node.state.store(BVHLeaf, std::memory_order_release);
+			return 0;
+		}
+		if(node.count < bvhParallelBinning) pool = nullptr;
+		const int left = nodeCount.fetch_add(2);
+		BVHNode &l = nodes[left], &r = nodes[left + 1];
+		l.first = node.first;
+		l.depth = r.depth = node.depth + 1;
+		bool fitted = false;
+		if(splitMethod == SahSplit && node.depth < sahMaxDepth) fitted = splitSah(node, l, r, pool);
+		else if(splitMethod == MortonSplit) splitMorton(node, l);
+		if(!fitted && !(splitMethod == MortonSplit && l.count > 0 && l.count < node.count)) splitMedian(node, l);
+		r.first = l.first + l.count;
+		r.count = node.count - l.count;
+		if(!fitted){
+			fitBounds(l, pool);
+			fitBounds(r, pool);
+		}
+		node.state.store(left, std::memory_order_release);
+		return left;
+	}
+
+	void splitMedian(BVHNode &node, BVHNode &l){
+		glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+		for(int p = node.first; p < node.first + node.count; p++){
+			lo = glm::min(lo, primitives[p].centroid);
+			hi = glm::max(hi, primitives[p].centroid);
+		}
+		glm::vec3 extent = hi - lo;
+		const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+		auto begin = primitives + node.first, middle = begin + node.count / 2;
+		std::nth_element(begin, middle, begin + node.count, [axis](const BVHPrimitive &a, const BVHPrimitive &b){
+			return a.centroid[axis] < b.centroid[axis] || (a.centroid[axis] == b.centroid[axis] && a.object < b.object);
+		});
+		node.axis = axis;
+		l.count = node.count / 2;
+	}
+
+	// The primitives are in code order: the left child gets those below the
+	// highest bit that differs in the range. Leaves l.count at 0 if all codes
+	// are equal.
+	void splitMorton(BVHNode &node, BVHNode &l){
+		const uint32_t a = primitives[node.first].code, b = primitives[node.first + node.count - 1].code;
+		l.count = 0;
+		if(a == b) return;
+		int bit = 31;
+		while(!((a ^ b) >> bit & 1)) bit--;
+		auto begin = primitives + node.first;
+		l.count = (int)(std::partition_point(begin, begin + node.count, [bit](const BVHPrimitive &p){ return !(p.code >> bit & 1); }) - begin);
+		node.axis = bit % 3;
+	}
+
+	// Binned SAH over all three axes; sets both children's bounds. False if
+	// the centroids can't be told apart (the caller falls back to median).
+	bool splitSah(BVHNode &node, BVHNode &l, BVHNode &r, ThreadPool *pool){
+		const int first = node.first, count = node.count;
+		const int chunks = pool ? pool->size() : 1;
+		std::vector<glm::vec3> chunkLo(chunks, glm::vec3(std::numeric_limits<float>::max())), chunkHi(chunks, glm::vec3(-std::numeric_limits<float>::max()));
+		forChunks(pool, first, count, [&](int chunk, int begin, int end){
+			for(int p = begin; p < end; p++){
+				chunkLo[chunk] = glm::min(chunkLo[chunk], primitives[p].centroid);
+				chunkHi[chunk] = glm::max(chunkHi[chunk], primitives[p].centroid);
+			}
+		});
+		glm::vec3 lo = chunkLo[0], hi = chunkHi[0];
+		for(int c = 1; c < chunks; c++){
+			lo = glm::min(lo, chunkLo[c]);
+			hi = glm::max(hi, chunkHi[c]);
+		}
+		glm::vec3 scale;
+		for(int a = 0; a < 3; a++) scale[a] = hi[a] > lo[a] ? sahBins / (hi[a] - lo[a]) : 0.0f;
+		auto binOf = [&](const BVHPrimitive &p, int a){ return std::min((int)((p.centroid[a] - lo[a]) * scale[a]), sahBins - 1); };
+
+		std::vector<SahBin> chunkBins((size_t)chunks * 3 * sahBins);
+		forChunks(pool, first, count, [&](int chunk, int begin, int end){
+			SahBin *bins = &chunkBins[(size_t)chunk * 3 * sahBins];
+			for(int p = begin; p < end; p++)
+				for(int a = 0; a < 3; a++) bins[a * sahBins + binOf(primitives[p], a)].add(primitives[p].lo, primitives[p].hi, 1);
+		});
+		SahBin bins[3][sahBins];
+		for(int c = 0; c < chunks; c++)
+			for(int a = 0; a < 3; a++)
+				for(int b = 0; b < sahBins; b++){
+					const SahBin &bin = chunkBins[((size_t)c * 3 + a) * sahBins + b];
+					if(bin.count) bins[a][b].add(bin.lo, bin.hi, bin.count);
+				}
+
+		// Cost of cutting after bin b: each side's area times its count.
+		float bestCost = std::numeric_limits<float>::max();
+		int bestAxis = -1, bestBin = 0;
+		for(int a = 0; a < 3; a++){
+			if(scale[a] == 0.0f) continue;
+			float rightCost[sahBins];
+			SahBin right;
+			for(int b = sahBins - 1; b > 0; b--){
+				if(bins[a][b].count) right.add(bins[a][b].lo, bins[a][b].hi, bins[a][b].count);
+				rightCost[b] = right.count ? halfArea(right.lo, right.hi) * right.count : 0.0f;
+			}
+			SahBin left;
+			for(int b = 0; b < sahBins - 1; b++){
+				if(bins[a][b].count) left.add(bins[a][b].lo, bins[a][b].hi, bins[a][b].count);
+				if(!left.count || left.count == count) continue;
+				float cost = halfArea(left.lo, left.hi) * left.count + rightCost[b + 1];
+				if(cost < bestCost){
+					bestCost = cost;
+					bestAxis = a;
+					bestBin = b;
+				}
+			}
+		}
+		if(bestAxis < 0) return false;
+
+		auto begin = primitives + first;
+		auto middle = std::partition(begin, begin + count, [&](const BVHPrimitive &p){ return binOf(p, bestAxis) <= bestBin; });
+		l.count = (int)(middle - begin);
+		SahBin left, right;
+		for(int b = 0; b < sahBins; b++)
+			if(bins[bestAxis][b].count) (b <= bestBin ? left : right).add(bins[bestAxis][b].lo, bins[bestAxis][b].hi, bins[bestAxis][b].count);
+		l.lo = left.lo;
+		l.hi = left.hi;
+		r.lo = right.lo;
+		r.hi = right.hi;
+		node.axis = bestAxis;
+		return true;
+	}
+
+	// First child of a node (0 for a leaf), splitting it if nobody has yet.
+	int children(int index) const{
+		BVHNode &node = nodes[index];
+		int state = node.state.load(std::memory_order_acquire);
+		while(state == BVHUnsplit || state == BVHSplitting){
+			int expected = BVHUnsplit;
+			if(state == BVHUnsplit && node.state.compare_exchange_strong(expected, BVHSplitting, std::memory_order_acquire))
+				return const_cast<BVH*>(this)->split(index, nullptr);
+			std::this_thread::yield();
+			state = node.state.load(std::memory_order_acquire);
+		}
+		return state == BVHLeaf ? 0 : state;
+	}
+
+	// Closest bounded object along the ray if it beats the hit in dist and
+	// object (closer, or as close with a lower index); updates both if so.
+	void intersect(const Ray &ray, float &dist, int &object) const{
+		if(!primitiveCount) return;
+		if(layout == WideBvh){
+			intersectWide(ray, dist, object);
+			return;
+		}
+		const glm::vec3 inv = glm::vec3(1.0f) / ray.dir;
+		int stack[bvhMaxDepth + 8], top = 0;
+		stack[top++] = 0;
+		while(top){
+			const int index = stack[--top];
+			const BVHNode &node = nodes[index];
+			if(!rayHitsBox(node.lo, node.hi, ray.orig, inv, dist)) continue;
+			const int left = children(index);
+			if(!left){
+				intersectLeaf(ray, node.first, node.count, dist, object);
+				continue;
+			}
+			// Nearer child on top.
+			const bool flip = ray.dir[node.axis] < 0.0f;
+			stack[top++] = left + !flip;
+			stack[top++] = left + flip;
+		}
+	}
+
+	void intersectLeaf(const Ray &ray, int first, int count, float &dist, int &object) const{
+		for(int p = first; p < first + count; p++){
+			const int o = primitives[p].object;
+			float t;
+			if(objects[o]->intersect(ray, t) && (t < dist || (t == dist && o < object))){
+				dist = t;
+				object = o;
+			}
+		}
+	}
+
+	// Collapses the (complete) binary tree into wide nodes, and traverses
+	// those from then on.
+	void widen(){
+		layout = WideBvh;
+		wideNodes.clear();
+		wideNodes.reserve(nodeCount / 2 + 1);
+		if(primitiveCount) collapse(0);
+	}
+
+	// The wide node for a binary node: its children, then the largest inner
+	// one of those opened up in its place, until there are four.
+	int collapse(int binary){
+		int children[4], count = 0;
+		const int left = nodes[binary].state.load(std::memory_order_relaxed);
+		if(left > 0){
+			children[count++] = left;
+			children[count++] = left + 1;
+		}
+		else children[count++] = binary; // a root that's a leaf
+		while(count < 4){
+			int open = -1;
+			float largest = -1.0f;
+			for(int c = 0; c < count; c++)
+				if(nodes[children[c]].state.load(std::memory_order_relaxed) > 0 && halfArea(nodes[children[c]].lo, nodes[children[c]].hi) > largest){
+					open = c;
+					largest = halfArea(nodes[children[c]].lo, nodes[children[c]].hi);
+				}
+			if(open < 0) break;
+			const int first = nodes[children[open]].state.load(std::memory_order_relaxed);
+			children[open] = first;
+			children[count++] = first + 1;
+		}
+
+		const int index = (int)wideNodes.size();
+		wideNodes.emplace_back();
+		WideBVHNode node = {};
+		const BVHNode &box = nodes[binary];
+		node.origin = box.lo;
+		for(int a = 0; a < 3; a++){
+			// 254 steps cover the box, so rounding can't push the last one short.
+			int e;
+			frexpf(std::max((box.hi[a] - box.lo[a]) / 254.0f, std::numeric_limits<float>::min()), &e);
+			node.exponent[a] = (int8_t)std::max(e, -126);
+		}
+		for(int c = 0; c < 4; c++){
+			for(int a = 0; a < 3; a++){
+				node.lo[a][c] = 255;
+				node.hi[a][c] = 0;
+			}
+			node.child[c] = -1;
+		}
+		for(int c = 0; c < count; c++){
+			const BVHNode &child = nodes[children[c]];
+			for(int a = 0; a < 3; a++){
+				// Rounded outwards, then checked the way traversal decodes them.
+				const float step = gridStep(node.exponent[a]), origin = node.origin[a];
+				int lo = std::min(std::max((int)std::floor((child.lo[a] - origin) / step), 0), 255);
+				int hi = std::min(std::max((int)std::ceil((child.hi[a] - origin) / step), 0), 255);
+				while(lo > 0 && origin + (float)lo * step > child.lo[a]) lo--;
+				while(hi < 255 && origin + (float)hi * step < child.hi[a]) hi++;
+				node.lo[a][c] = (uint8_t)lo;
+				node.hi[a][c] = (uint8_t)hi;
+			}
+			if(child.state.load(std::memory_order_relaxed) == BVHLeaf){
+				node.child[c] = child.first;
+				node.count[c] = (uint8_t)child.count;
+			}
+			else node.child[c] = collapse(children[c]);
+		}
+		wideNodes[index] = node;
+		return index;
+	}
+
+	// All four children of a node against the ray at once, in SSE2 where
+	// there is (tNear set for those it enters, like rayHitsBox; max and min
+	// keep the first operand's NaN handling).
+	static int enterWide(const WideBVHNode &node, glm::vec3 orig, glm::vec3 inv, float tMax, float *tNear){
+		const uint8_t *nearQ[3], *farQ[3];
+		float origin[3], step[3];
+		for(int a = 0; a < 3; a++){
+			nearQ[a] = inv[a] < 0.0f ? node.hi[a] : node.lo[a];
+			farQ[a] = inv[a] < 0.0f ? node.lo[a] : node.hi[a];
+			origin[a] = node.origin[a] - orig[a];
+			step[a] = gridStep(node.exponent[a]);
+		}
+#ifdef BVH_SSE2
+		__m128 tn = _mm_setzero_ps(), tf = _mm_set1_ps(tMax * 1.0001f);
+		for(int a = 0; a < 3; a++){
+			const __m128 o = _mm_set1_ps(origin[a]), s = _mm_set1_ps(step[a]), i = _mm_set1_ps(inv[a]);
+			tn = _mm_max_ps(_mm_mul_ps(_mm_add_ps(o, _mm_mul_ps(gridToFloats(nearQ[a]), s)), i), tn);
+			tf = _mm_min_ps(_mm_mul_ps(_mm_add_ps(o, _mm_mul_ps(gridToFloats(farQ[a]), s)), i), tf);
+		}
+		_mm_storeu_ps(tNear, tn);
+		return _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+#else
+		int entered[4];
+		for(int c = 0; c < 4; c++){
+			float tn = 0.0f, tf = tMax * 1.0001f;
+			for(int a = 0; a < 3; a++){
+				float t0 = (origin[a] + (float)nearQ[a][c] * step[a]) * inv[a];
+				float t1 = (origin[a] + (float)farQ[a][c] * step[a]) * inv[a];
+				tn = t0 > tn ? t0 : tn;
+				tf = t1 < tf ? t1 : tf;
+			}
+			tNear[c] = tn;
+			entered[c] = tn <= tf;
+		}
+		return entered[0] | entered[1] << 1 | entered[2] << 2 | entered[3] << 3;
+#endif
+	}
+
+	void intersectWide(const Ray &ray, float &dist, int &object) const{
+		const glm::vec3 inv = glm::vec3(1.0f) / ray.dir;
+		// Inner nodes with the distance the ray enters them, nearest on top.
+		struct Entry{ int node; float tNear; };
+		Entry stack[3 * bvhMaxDepth + 8];
+		int top = 0;
+		stack[top++] = {0, 0.0f};
+		while(top){
+			const Entry entry = stack[--top];
+			if(entry.tNear > dist * 1.0001f) continue;
+			const WideBVHNode &node = wideNodes[entry.node];
+			float tNear[4];
+			const int entered = enterWide(node, ray.orig, inv, dist, tNear);
+			int order[4], n = 0; // nearest first
+			for(int c = 0; c < 4; c++){
+				if(!(entered >> c & 1)) continue;
+				int k = n++;
+				for(; k > 0 && tNear[order[k - 1]] > tNear[c]; k--) order[k] = order[k - 1];
+				order[k] = c;
+			}
+			for(int k = 0; k < n; k++)
+				if(node.count[order[k]]) intersectLeaf(ray, node.child[order[k]], node.count[order[k]], dist, object);
+			for(int k = n - 1; k >= 0; k--)
+				if(!node.count[order[k]]) stack[top++] = {node.child[order[k]], tNear[order[k]]};
+		}
+	}
+
+	size_t nodeBytes() const{
+		return layout == BinaryBvh ? nodeCount * sizeof(BVHNode) : wideNodes.size() * sizeof(WideBVHNode);
+	}
+
+	// Nodes that are still unsplit ranges, and the primitives in them: what
+	// no ray has reached below the eager levels.
+	void census(int &unsplitNodes, size_t &unsplitPrimitives) const{
+		unsplitNodes = 0;
+		unsplitPrimitives = 0;
+		for(int n = 0, count = nodeCount; n < count; n++)
+			if(nodes[n].state.load(std::memory_order_acquire) == BVHUnsplit){
+				unsplitNodes++;
+				unsplitPrimitives += nodes[n].count;
+			}
+	}
+
+	// Expected cost of a ray through the root's box: one per node it enters,
+	// one per primitive it tests, with entry chances by surface area. Unsplit
+	// nodes count as leaves, so a lazy tree's cost is of what is built so far.
+	double sahCost() const{
+		if(!primitiveCount) return 0.0;
+		const double rootArea = halfArea(nodes[0].lo, nodes[0].hi);
+		if(rootArea <= 0.0) return 0.0;
+		double cost = 0.0;
+		for(int n = 0, count = nodeCount; n < count; n++){
+			const BVHNode &node = nodes[n];
+			const double chance = halfArea(node.lo, node.hi) / rootArea;
+			cost += chance * (node.state.load(std::memory_order_acquire) > 0 ? 1.0 : node.count);
+		}
+		return cost;
+	}
+};
+
+// The hierarchy over the objects cast_ray is handed, set by the renderer
+// around tiles rendered with one.
+thread_local const BVH *sceneBvh = nullptr;
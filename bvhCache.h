@@ -0,0 +1,185 @@
+// On-disk cache of complete hierarchies, for scenes rendered again and again
+// from other cameras. A file is named by the hash of the scene's geometry
+// (every object's bounds, in scene order) and the split, and holds a header,
+// the primitives and the nodes exactly as they are in memory, so loading is
+// mapping the file and pointing the tree into it. A file from another
+// version, another build of the program or other geometry, or one that is cut
+// short or changed (it carries a checksum), is rebuilt and written over.
+//
+// Lazy renders load a cached tree too (it's complete), but only full builds
+// write one.
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#endif
+
+struct BVHCacheHeader{
+	char magic[4] = {'R', 'D', 'B', 'V'};
+	uint32_t version = 1;
+	uint64_t geometry = 0;
+	uint32_t split = 0, objects = 0;
+	uint32_t primitives = 0, nodes = 0;
+	uint32_t primitiveSize = sizeof(BVHPrimitive), nodeSize = sizeof(BVHNode); // layout of this build
+	uint64_t checksum = 0; // of everything after the header
+};
+
+// FNV-1a over 32 bit words rather than bytes, to check a large file in a few
+// milliseconds.
+inline uint64_t hashWords(uint64_t h, const void *data, size_t size){
+	const uint32_t *words = (const uint32_t*)data;
+	for(size_t i = 0; i < size / 4; i++){
+		h ^= words[i];
+		h *= 1099511628211ull;
+	}
+	return hashBytes(h, words + size / 4, size % 4);
+}
+
+inline uint64_t geometryHash(const std::vector<Object*> &objects){
+	uint64_t h = 14695981039346656037ull;
+	for(const Object *object : objects){
+		glm::vec3 box[2];
+		const uint8_t bounded = object->bounds(box[0], box[1]);
+		h = hashBytes(h, &bounded, 1);
+		if(bounded) h = hashBytes(h, box, sizeof(box));
+	}
+	return h;
+}
+
+// A whole file, read only: mapped where there is mmap, read in elsewhere.
+struct MappedFile{
+	const void *data = nullptr;
+	size_t size = 0;
+	std::vector<uint64_t> copy;
+
+	bool open(const std::string &path){
+#ifndef _WIN32
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if(fd < 0) return false;
+		struct stat info;
+		if(fstat(fd, &info) || info.st_size <= 0){
+			::close(fd);
+			return false;
+		}
+		void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(mapped == MAP_FAILED) return false;
+		data = mapped;
+		size = info.st_size;
+		return true;
+#else
+		FILE *f = fopen(path.c_str(), "rb");
+		if(!f) return false;
+		fseek(f, 0, SEEK_END);
+		long length = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		copy.resize((std::max(length, 0L) + 7) / 8);
+		bool read = length > 0 && fread(copy.data(), 1, length, f) == (size_t)length;
+		fclose(f);
+		if(!read) return false;
+		data = copy.data();
+		size = length;
+		return true;
+#endif
+	}
+	~MappedFile(){
+#ifndef _WIN32
+		if(data) munmap(const_cast<void*>(data), size);
+#endif
+	}
+};
+
+inline std::string bvhCacheFile(const std::string &directory, uint64_t geometry, BvhSplit split){
+	const char *names[] = {"median", "sah", "morton"};
+	char name[48];
+	snprintf(name, sizeof(name), "%016llx.%s.bvh", (unsigned long long)geometry, names[split]);
+	return directory + "/" + name;
+}
+
+// The cached tree for the objects, or null (stale set if there was a file,
+// but not one to use).
+inline std::shared_ptr<BVH> loadBvh(const std::string &directory, const std::vector<Object*> &objects, BvhBuild build, BvhSplit split,
+	uint64_t geometry, bool &stale){
+	auto start = std::chrono::steady_clock::now();
+	std::string path = bvhCacheFile(directory, geometry, split);
+	stale = std::filesystem::exists(path);
+	auto file = std::make_shared<MappedFile>();
+	if(!file->open(path)) return nullptr;
+
+	BVHCacheHeader header, expected;
+	if(file->size < sizeof(header)) return nullptr;
+	memcpy(&header, file->data, sizeof(header));
+	std::shared_ptr<BVH> bvh = std::make_shared<BVH>(objects, build, split);
+	if(memcmp(header.magic, expected.magic, 4) || header.version != expected.version || header.geometry != geometry ||
+		header.split != (uint32_t)split || header.objects != objects.size() || header.primitives != objects.size() - bvh->unbounded.size() ||
+		header.primitiveSize != expected.primitiveSize || header.nodeSize != expected.nodeSize || header.nodes < 1 ||
+		file->size != sizeof(header) + (size_t)header.primitives * sizeof(BVHPrimitive) + (size_t)header.nodes * sizeof(BVHNode) ||
+		hashWords(14695981039346656037ull, (const char*)file->data + sizeof(header), file->size - sizeof(header)) != header.checksum)
+		return nullptr;
+	BVHPrimitive *primitives = (BVHPrimitive*)((const char*)file->data + sizeof(header));
+	BVHNode *nodes = (BVHNode*)(primitives + header.primitives);
+
+	// Everything traversal follows has to stay inside the file, and within
+	// its stack, whatever wrote it: children come after their parent, so
+	// depths are known in one pass.
+	for(uint32_t p = 0; p < header.primitives; p++)
+		if(primitives[p].object < 0 || primitives[p].object >= (int)objects.size()) return nullptr;
+	std::vector<uint8_t> depth(header.nodes, 0);
+	for(uint32_t n = 0; n < header.nodes; n++){
+		const BVHNode &node = nodes[n];
+		const int state = node.state.load(std::memory_order_relaxed);
+		if(node.first < 0 || node.count < 0 || (uint32_t)node.first + node.count > header.primitives) return nullptr;
+		if(state == BVHLeaf) continue;
+		if(state <= (int)n || (uint32_t)state + 1 >= header.nodes || depth[n] >= bvhMaxDepth) return nullptr;
+		depth[state] = depth[state + 1] = depth[n] + 1;
+	}
+
+	bvh->primitives = primitives;
+	bvh->primitiveCount = header.primitives;
+	bvh->nodes = nodes;
+	bvh->nodeCount = header.nodes;
+	bvh->storage = file;
+	bvh->buildSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	stale = false;
+	return bvh;
+}
+
+// Writes a complete tree for later renders, through a temporary file so a
+// reader never maps half of one. The temporary file is named for the process
+// and thread, so writers of the same geometry each rename their own whole
+// file into place.
+inline bool saveBvh(const std::string &directory, const BVH &bvh, uint64_t geometry){
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	BVHCacheHeader header;
+	header.geometry = geometry;
+	header.split = bvh.splitMethod;
+	header.objects = bvh.objects.size();
+	header.primitives = bvh.primitiveCount;
+	header.nodes = bvh.nodeCount;
+	header.checksum = hashWords(hashWords(14695981039346656037ull, bvh.primitives, header.primitives * sizeof(BVHPrimitive)),
+		bvh.nodes, header.nodes * sizeof(BVHNode));
+#ifndef _WIN32
+	const long pid = (long)getpid();
+#else
+	const long pid = (long)_getpid();
+#endif
+	std::string path = bvhCacheFile(directory, geometry, bvh.splitMethod);
+	std::string temp = path + "." + std::to_string(pid) + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	FILE *f = fopen(temp.c_str(), "wb");
+	if(!f) return false;
+	bool written = fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(bvh.primitives, sizeof(BVHPrimitive), header.primitives, f) == header.primitives &&
+		fwrite(bvh.nodes, sizeof(BVHNode), header.nodes, f) == header.nodes;
+	written = fclose(f) == 0 && written;
+	if(written){
+		std::filesystem::rename(temp, path, error);
+		written = !error;
+	}
+	if(!written) std::filesystem::remove(temp, error);
+	return written;
+}
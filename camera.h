@@ -0,0 +1,140 @@
+// Pinhole/thin lens/orthographic camera. The basis and the film mapping are
+// worked out once in update(), ray generation is then a couple of FMAs per ray
+// done over whole batches.
+
+enum Projection{
+	Perspective, Orthographic
+};
+
+// Structure of arrays so generateRays vectorizes. The caller fills the
+// raster position (and lens sample) of every ray, the camera fills the rays.
+struct RayBatch{
+	std::vector<float> px, py, lensU, lensV;
+	std::vector<float> ox, oy, oz, dx, dy, dz;
+
+	void resize(size_t n){
+		for(auto *v : {&px, &py, &lensU, &lensV, &ox, &oy, &oz, &dx, &dy, &dz}) v->resize(n);
+	}
+	size_t size() const{ return px.size(); }
+	Ray ray(size_t i) const{
+		return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i]));
+	}
+};
+
+struct Camera{
+	glm::vec3 origin, forward, right, up;
+	float fov = glm::pi<float>() / 4.0f;
+	int width = 1, height = 1;
+	Projection projection = Perspective;
+	float orthoHeight = 10.0f;
+	float aperture = 0.0f, focusDistance = 10.0f;
+
+	// Raster (x, y) maps to corner + du * x + dv * y, a direction at unit
+	// forward distance for perspective or a film position for orthographic.
+	glm::vec3 corner, du, dv;
+
+	Camera() = default;
+
+	static Camera lookAt(glm::vec3 from, glm::vec3 to, glm::vec3 worldUp, float fov, int width, int height){
+		Camera cam;
+		cam.origin = from;
+		cam.forward = glm::normalize(to - from);
+		cam.right = glm::normalize(glm::cross(cam.forward, worldUp));
+		cam.up = glm::cross(cam.right, cam.forward);
+		cam.fov = fov;
+		cam.width = width;
+		cam.height = height;
+		cam.update();
+		return cam;
+	}
+
+	void setDepthOfField(float lensRadius, float focus){
+		aperture = lensRadius;
+		focusDistance = focus;
+		update();
+	}
+	void setOrthographic(float viewHeight){
+		projection = Orthographic;
+		orthoHeight = viewHeight;
+		update();
+	}
+
+	void update(){
+		float aspect = width / (float)height;
+		float halfH = projection == Orthographic ? orthoHeight * 0.5f : std::tan(fov * 0.5f);
+		float halfW = halfH * aspect;
+		corner = (projection == Orthographic ? origin : forward) - right * halfW + up * halfH;
+		du = right * (2.0f * halfW / width);
+		dv = up * (-2.0f * halfH / height);
+	}
+
+	// All primary rays start at the origin.
+	bool isPinhole() const{ return projection == Perspective && aperture <= 0.0f; }
+
+	// Raster position of a point in front of a perspective camera.
+	glm::vec2 project(glm::vec3 p) const{
+		glm::vec3 film = (p - origin) * (1.0f / glm::dot(p - origin, forward)) - corner;
+		return glm::vec2(glm::dot(film, du) / glm::dot(du, du), glm::dot(film, dv) / glm::dot(dv, dv));
+	}
+
+	// Single ray, for the odd caller that doesn't batch.
+	Ray generateRay(float x, float y, glm::vec2 lens) const{
+		RayBatch batch;
+		batch.resize(1);
+		batch.px[0] = x; batch.py[0] = y;
+		batch.lensU[0] = lens.x; batch.lensV[0] = lens.y;
+		generateRays(batch);
+		return batch.ray(0);
+	}
+
+	void generateRays(RayBatch &batch) const{
+		const int n = (int)batch.size();
+		const float *px = batch.px.data(), *py = batch.py.data();
+		float *lu = batch.lensU.data(), *lv = batch.lensV.data();
+		float *ox = batch.ox.data(), *oy = batch.oy.data(), *oz = batch.oz.data();
+		float *dx = batch.dx.data(), *dy = batch.dy.data(), *dz = batch.dz.data();
+		const glm::vec3 c = corner, u = du, v = dv, o = origin, f = forward, r = right, w = up;
+
+		if(projection == Orthographic){
+			#pragma omp simd
+			for(int i = 0; i < n; i++){
+				ox[i] = c.x + u.x * px[i] + v.x * py[i];
+				oy[i] = c.y + u.y * px[i] + v.y * py[i];
+				oz[i] = c.z + u.z * px[i] + v.z * py[i];
+				dx[i] = f.x; dy[i] = f.y; dz[i] = f.z;
+			}
+			return;
+		}
+
+		#pragma omp simd
+		for(int i = 0; i < n; i++){
+			float x = c.x + u.x * px[i] + v.x * py[i];
+			float y = c.y + u.y * px[i] + v.y * py[i];
+			float z = c.z + u.z * px[i] + v.z * py[i];
+			float inv = 1.0f / std::sqrt(x * x + y * y + z * z);
+			ox[i] = o.x; oy[i] = o.y; oz[i] = o.z;
+			dx[i] = x * inv; dy[i] = y * inv; dz[i] = z * inv;
+		}
+		if(aperture <= 0.0f) return;
+
+		// Thin lens: the trig of the disc mapping stays scalar, the rest is batched.
+		for(int i = 0; i < n; i++){
+			float radius = aperture * std::sqrt(lu[i]), phi = 2.0f * glm::pi<float>() * lv[i];
+			lu[i] = radius * std::cos(phi);
+			lv[i] = radius * std::sin(phi);
+		}
+		const float focus = focusDistance;
+		#pragma omp simd
+		for(int i = 0; i < n; i++){
+			// Point on the focal plane this pinhole ray passes through.
+			float t = focus / (dx[i] * f.x + dy[i] * f.y + dz[i] * f.z);
+			float fx = o.x + dx[i] * t, fy = o.y + dy[i] * t, fz = o.z + dz[i] * t;
+			ox[i] = o.x + r.x * lu[i] + w.x * lv[i];
+			oy[i] = o.y + r.y * lu[i] + w.y * lv[i];
+			oz[i] = o.z + r.z * lu[i] + w.z * lv[i];
+			float x = fx - ox[i], y = fy - oy[i], z = fz - oz[i];
+			float inv = 1.0f / std::sqrt(x * x + y * y + z * z);
+			dx[i] = x * inv; dy[i] = y * inv; dz[i] = z * inv;
+		}
+	}
+};
@@ -0,0 +1,202 @@
+// Tile-level render state plus periodic checkpoints of it, so a long render
+// can be picked up again with --resume after a crash.
+
+inline uint32_t hashCombine(uint32_t h, const void *data, size_t size){
+	const uint8_t *bytes = (const uint8_t*)data;
+	for(size_t i = 0; i < size; i++){
+		h ^= bytes[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// Everything that changes what a pixel ends up as. A checkpoint is only
+// resumed when this matches.
+inline uint32_t sceneHash(const std::vector<Object*> &stuff, const std::vector<Light> &lights){
+	uint32_t h = 2166136261u;
+	for(auto &object : stuff){
+		h = hashCombine(h, &object->pos, sizeof(glm::vec3));
+		h = hashCombine(h, &object->material.pbrCtrl, sizeof(glm::vec3));
+		h = hashCombine(h, &object->material.color, sizeof(glm::vec3));
+		h = hashCombine(h, &object->material.specualirity, sizeof(float));
+		h = hashCombine(h, &object->material.type, sizeof(MaterialType));
+		if(Sphere *sphere = dynamic_cast<Sphere*>(object))
+			h = hashCombine(h, &sphere->radius, sizeof(float));
+		if(Plane *plane = dynamic_cast<Plane*>(object))
+			h = hashCombine(h, &plane->normal, sizeof(glm::vec3));
+	}
+	for(auto &light : lights){
+		h = hashCombine(h, &light.pos, sizeof(glm::vec3));
+		h = hashCombine(h, &light.color, sizeof(glm::vec3));
+		h = hashCombine(h, &light.intensity, sizeof(float));
+		h = hashCombine(h, &light.radius, sizeof(float));
+	}
+	return h;
+}
+
+inline uint32_t cameraHash(const Camera &camera){
+	uint32_t h = 2166136261u;
+	for(const glm::vec3 *v : {&camera.origin, &camera.forward, &camera.up})
+		h = hashCombine(h, v, sizeof(glm::vec3));
+	for(const float *f : {&camera.fov, &camera.orthoHeight, &camera.aperture, &camera.focusDistance})
+		h = hashCombine(h, f, sizeof(float));
+	return hashCombine(h, &camera.projection, sizeof(Projection));
+}
+
+struct CheckpointHeader{
+	char magic[4] = {'R', 'D', 'C', 'K'};
+	uint32_t version = 3;
+	uint32_t width = 0, height = 0, tileSize = 0, samples = 0;
+	uint32_t seed = 0, sampler = 0, blueNoise = 0, hasGuide = 0, scene = 0, camera = 0;
+	uint32_t shadowMapResolution = 0;
+	float shadowMapBias = 0.0f;
+	uint32_t math = 0;
+
+	bool operator==(const CheckpointHeader &o) const{
+		return !memcmp(this, &o, sizeof(CheckpointHeader));
+	}
+};
+
+// Finished pixels of the frame. A tile's pixels are written only by the
+// thread rendering it, and are read by others only after its done flag is set.
+// The pixels live in the caller's buffers (guide may be null), which aren't
+// assumed to be initialized; clearRows must cover every row before use
+// (ThreadPool::firstTouch does that from the node that renders them).
+struct FrameState{
+	int width, height, tileSize, tilesX, tilesY, tileCount;
+	glm::vec3 *color;
+	GBufferSample *guide;
+	std::unique_ptr<std::atomic<uint8_t>[]> tileDone;
+
+	FrameState(int w, int h, int ts, glm::vec3 *c, GBufferSample *g) : width(w), height(h), tileSize(ts), color(c), guide(g) {
+		tilesX = (w + ts - 1) / ts;
+		tilesY = (h + ts - 1) / ts;
+		tileCount = tilesX * tilesY;
+		tileDone.reset(new std::atomic<uint8_t>[tileCount]);
+		for(int t = 0; t < tileCount; t++) tileDone[t].store(0, std::memory_order_relaxed);
+	}
+
+	void clearRows(int y0, int y1){
+		size_t begin = (size_t)y0 * width, n = (size_t)(y1 - y0) * width;
+		memset((void*)&color[begin], 0, n * sizeof(glm::vec3));
+		for(size_t p = begin; guide && p < begin + n; p++) guide[p] = GBufferSample();
+	}
+
+	void tileBounds(int tile, int &x0, int &y0, int &x1, int &y1) const{
+		x0 = (tile % tilesX) * tileSize;
+		y0 = (tile / tilesX) * tileSize;
+		x1 = std::min(x0 + tileSize, width);
+		y1 = std::min(y0 + tileSize, height);
+	}
+	bool isDone(int tile) const{
+		return tileDone[tile].load(std::memory_order_acquire);
+	}
+	void markDone(int tile){
+		tileDone[tile].store(1, std::memory_order_release);
+	}
+
+	// Fixed sample renders: every pixel of a finished tile has them all, the
+	// pixels of the others none.
+	void fillSampleCount(int *sampleCount, int samples) const{
+		for(int tile = 0; tile < tileCount; tile++){
+			int x0, y0, x1, y1;
+			tileBounds(tile, x0, y0, x1, y1);
+			const int n = isDone(tile) ? samples : 0;
+			for(int y = y0; y < y1; y++)
+				std::fill(sampleCount + (size_t)y * width + x0, sampleCount + (size_t)y * width + x1, n);
+		}
+	}
+
+	bool save(const char *filename, const CheckpointHeader &header) const{
+		std::string temp = std::string(filename) + ".tmp";
+		FILE *f = fopen(temp.c_str(), "wb");
+		if(!f) return false;
+		std::vector<uint32_t> done;
+		for(int t = 0; t < tileCount; t++)
+			if(isDone(t)) done.push_back(t);
+		uint32_t doneCount = done.size();
+		bool ok = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(&doneCount, 4, 1, f) == 1;
+		for(uint32_t t : done){
+			int x0, y0, x1, y1;
+			tileBounds(t, x0, y0, x1, y1);
+			ok = ok && fwrite(&t, 4, 1, f) == 1;
+			for(int y = y0; y < y1 && ok; y++){
+				size_t row = (size_t)y * width + x0, n = x1 - x0;
+				ok = fwrite(&color[row], sizeof(glm::vec3), n, f) == n;
+				if(ok && guide) ok = fwrite(&guide[row], sizeof(GBufferSample), n, f) == n;
+			}
+		}
+		ok = (fclose(f) == 0) && ok;
+		// Rename last so a crash mid-write never clobbers the previous checkpoint.
+		std::remove(filename);
+		return ok && std::rename(temp.c_str(), filename) == 0;
+	}
+
+	// Returns the number of restored tiles, or -1 if the file doesn't belong to this render.
+	int load(const char *filename, const CheckpointHeader &expected){
+		FILE *f = fopen(filename, "rb");
+		if(!f) return -1;
+		CheckpointHeader header;
+		uint32_t doneCount = 0;
+		int restored = -1;
+		if(fread(&header, sizeof(header), 1, f) == 1 && header == expected && fread(&doneCount, 4, 1, f) == 1){
+			restored = 0;
+			for(uint32_t i = 0; i < doneCount; i++){
+				uint32_t t;
+				if(fread(&t, 4, 1, f) != 1 || t >= (uint32_t)tileCount) break;
+				int x0, y0, x1, y1;
+				tileBounds(t, x0, y0, x1, y1);
+				bool ok = true;
+				for(int y = y0; y < y1 && ok; y++){
+					size_t row = (size_t)y * width + x0, n = x1 - x0;
+					ok = fread(&color[row], sizeof(glm::vec3), n, f) == n;
+					if(ok && guide) ok = fread(&guide[row], sizeof(GBufferSample), n, f) == n;
+				}
+				if(!ok) break;
+				markDone(t);
+				restored++;
+			}
+		}
+		fclose(f);
+		return restored;
+	}
+};
+
+// Writes checkpoints from its own thread every interval seconds, so the
+// render threads never wait on disk.
+struct Checkpointer{
+	const FrameState &frame;
+	CheckpointHeader header;
+	std::string filename;
+	float interval;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	Checkpointer(const FrameState &f, const CheckpointHeader &h, const std::string &name, float seconds) :
+		frame(f), header(h), filename(name), interval(seconds) {
+		if(interval > 0.0f)
+			worker = std::thread([this]{ run(); });
+	}
+	~Checkpointer(){ stop(); }
+
+	void run(){
+		std::unique_lock<std::mutex> lock(mutex);
+		while(!wake.wait_for(lock, std::chrono::duration<float>(interval), [this]{ return stopping; })){
+			lock.unlock();
+			if(!frame.save(filename.c_str(), header))
+				std::cerr << "Couldn't write checkpoint " << filename << std::endl;
+			lock.lock();
+		}
+	}
+
+	void stop(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		if(worker.joinable()) worker.join();
+	}
+};
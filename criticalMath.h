@@ -10,7 +10,8 @@ struct Light{
 	glm::vec3 pos;
 	glm::vec3 color;
 	float intensity;
-	Light(glm::vec3 p, glm::vec3 c,float i) : pos(p), color(c),intensity(i) {}
+	float radius = 0.0f;
+	Light(glm::vec3 p, glm::vec3 c,float i, float r = 0.0f) : pos(p), color(c),intensity(i), radius(r) {}
 	Light() = default;
 };
 
@@ -20,16 +21,27 @@ struct Ray{
 };
 
 enum MaterialType{
-	Diffuse, Specular, Reflective, Checkered, SphereCheckered, Textured
+	Diffuse, Specular, Reflective, Checkered, SphereCheckered, Textured, MaterialTypeCount
 };
 
 
+// FNV-1a, used to give materials a stable ID derived from their name.
+inline uint32_t hashName(const std::string &name){
+	uint32_t h = 2166136261u;
+	for(char c : name){
+		h ^= (uint8_t)c;
+		h *= 16777619u;
+	}
+	return h;
+}
+
 struct Material{
 	glm::vec3 pbrCtrl = glm::vec3(1.0, 1.0, 0.0);
 	glm::vec3 color;
 	float specualirity;
 	MaterialType type;
 	std::string name;
+	uint32_t id = 0;
 	
 	Material(glm::vec3 throttle, glm::vec3 diff, float specular, MaterialType t) : pbrCtrl(throttle), color(diff), specualirity(specular), type(t) {}
 	Material() = default;
@@ -45,6 +57,7 @@ struct Material{
 	}
 	void setString(std::string neam){
 		name = neam;
+		id = hashName(name);
 	}
 };
 
@@ -61,8 +74,13 @@ struct Object{
 	Material material;
 	Object(glm::vec3 p, Material mat) : pos(p), material(mat) {}
 	Object() = default;
+	virtual ~Object() = default;
 	virtual bool intersect(Ray ray, float &dist) = 0;
 	virtual glm::vec3 getNormal(glm::vec3 hitPoint) = 0;
+	virtual Object *clone() const = 0;
+	virtual bool overlapsBox(glm::vec3 lo, glm::vec3 hi) const = 0;
+	virtual bool bounds(glm::vec3 &lo, glm::vec3 &hi) const = 0; // false if unbounded
+	virtual bool nearSegment(glm::vec3 a, glm::vec3 b, float distance) const = 0; // within distance of the segment a..b
 };
 
 struct Sphere : Object{
@@ -94,6 +112,23 @@ struct Sphere : Object{
 	glm::vec3 getNormal(glm::vec3 hitPoint){
 		return glm::normalize(hitPoint - pos);
 	}
+	Object *clone() const{ return new Sphere(*this); }
+	bool overlapsBox(glm::vec3 lo, glm::vec3 hi) const{
+		glm::vec3 d = pos - glm::clamp(pos, lo, hi);
+		return glm::dot(d, d) <= radius * radius;
+	}
+	bool nearSegment(glm::vec3 a, glm::vec3 b, float distance) const{
+		glm::vec3 ab = b - a;
+		float length2 = glm::dot(ab, ab);
+		float t = length2 > 0.0f ? glm::clamp(glm::dot(pos - a, ab) / length2, 0.0f, 1.0f) : 0.0f;
+		glm::vec3 d = pos - (a + ab * t);
+		return glm::dot(d, d) <= (radius + distance) * (radius + distance);
+	}
+	bool bounds(glm::vec3 &lo, glm::vec3 &hi) const{
+		lo = pos - glm::vec3(radius);
+		hi = pos + glm::vec3(radius);
+		return true;
+	}
 };
 
 struct Plane : Object{
@@ -112,4 +147,14 @@ struct Plane : Object{
 	glm::vec3 getNormal(glm::vec3 hitPoint){
 		return normal;
 	}
-};
\ No newline at end of file
+	Object *clone() const{ return new Plane(*this); }
+	bool overlapsBox(glm::vec3 lo, glm::vec3 hi) const{
+		glm::vec3 center = (lo + hi) * 0.5f, extent = (hi - lo) * 0.5f;
+		return std::abs(glm::dot(normal, center - pos)) <= glm::dot(glm::abs(normal), extent);
+	}
+	bool nearSegment(glm::vec3 a, glm::vec3 b, float distance) const{
+		float da = glm::dot(normal, a - pos), db = glm::dot(normal, b - pos), reach = distance * glm::length(normal);
+		return std::min(da, db) <= reach && std::max(da, db) >= -reach;
+	}
+	bool bounds(glm::vec3 &, glm::vec3 &) const{ return false; }
+};
@@ -0,0 +1,114 @@
+// Edge-avoiding a-trous wavelet denoiser (Dammertz et al. 2010), guided by
+// the normal, albedo and depth of the primary hit written by cast_ray.
+
+struct DenoiseSettings{
+	int iterations = 5;
+	float sigmaColor = 0.3f, sigmaNormal = 0.3f, sigmaAlbedo = 0.1f, sigmaDepth = 0.05f;
+};
+
+// Planar layout so that the filter's row loops vectorize.
+struct DenoiseImage{
+	enum Plane{ R, G, B, NX, NY, NZ, AR, AG, AB, Z, PlaneCount };
+	int width, height;
+	std::vector<float> plane[PlaneCount];
+
+	DenoiseImage(int w, int h) : width(w), height(h) {
+		for(auto &p : plane) p.assign((size_t)w * h, 0.0f);
+	}
+
+	void setPixel(int idx, glm::vec3 color, const GBufferSample &guide){
+		plane[R][idx] = color.x; plane[G][idx] = color.y; plane[B][idx] = color.z;
+		plane[NX][idx] = guide.normal.x; plane[NY][idx] = guide.normal.y; plane[NZ][idx] = guide.normal.z;
+		plane[AR][idx] = guide.albedo.x; plane[AG][idx] = guide.albedo.y; plane[AB][idx] = guide.albedo.z;
+		plane[Z][idx] = guide.depth;
+	}
+	glm::vec3 color(int idx) const{
+		return glm::vec3(plane[R][idx], plane[G][idx], plane[B][idx]);
+	}
+};
+
+// exp(-e) for e >= 0 as (1 + e/32)^-32. Close enough for an edge-stopping
+// function and, unlike a clamped exp, it vectorizes without -ffast-math.
+inline float edgeStop(float e){
+	float r = 1.0f / (1.0f + e * (1.0f / 32.0f));
+	r *= r; r *= r; r *= r; r *= r; r *= r;
+	return r;
+}
+
+// Rows are split evenly over the pool's workers.
+inline void denoise(DenoiseImage &img, const DenoiseSettings &settings, ThreadPool &pool){
+	const int w = img.width, h = img.height;
+	const float kernel[5] = {1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+	std::vector<float> out[3];
+	for(auto &o : out) o.resize((size_t)w * h);
+
+	const float invNormal = 1.0f / (settings.sigmaNormal * settings.sigmaNormal);
+	const float invAlbedo = 1.0f / (settings.sigmaAlbedo * settings.sigmaAlbedo);
+	const float invDepth = 1.0f / (settings.sigmaDepth * settings.sigmaDepth);
+
+	for(int iteration = 0; iteration < settings.iterations; iteration++){
+		const int step = 1 << iteration;
+		// Colour gets less trusted at coarser levels.
+		const float sigmaColor = settings.sigmaColor / step;
+		const float invColor = 1.0f / (sigmaColor * sigmaColor);
+
+		pool.broadcast([&](int worker){
+			// Thread-local copies of the plane pointers keep the inner loop free of shared loads.
+			const float *cr = img.plane[DenoiseImage::R].data(), *cg = img.plane[DenoiseImage::G].data(), *cb = img.plane[DenoiseImage::B].data();
+			const float *nx = img.plane[DenoiseImage::NX].data(), *ny = img.plane[DenoiseImage::NY].data(), *nz = img.plane[DenoiseImage::NZ].data();
+			const float *ar = img.plane[DenoiseImage::AR].data(), *ag = img.plane[DenoiseImage::AG].data(), *ab = img.plane[DenoiseImage::AB].data();
+			const float *z = img.plane[DenoiseImage::Z].data();
+			const float invColorLocal = invColor;
+			std::vector<float> sumR(w), sumG(w), sumB(w), sumW(w);
+			const int y0 = (int)((int64_t)h * worker / pool.size()), y1 = (int)((int64_t)h * (worker + 1) / pool.size());
+			for(int y = y0; y < y1; y++){
+				std::fill(sumR.begin(), sumR.end(), 0.0f);
+				std::fill(sumG.begin(), sumG.end(), 0.0f);
+				std::fill(sumB.begin(), sumB.end(), 0.0f);
+				std::fill(sumW.begin(), sumW.end(), 0.0f);
+				const size_t row = (size_t)y * w;
+
+				for(int ky = -2; ky <= 2; ky++){
+					int yy = y + ky * step;
+					if(yy < 0 || yy >= h) continue;
+					for(int kx = -2; kx <= 2; kx++){
+						// Taps falling off the image are dropped, the weights renormalize.
+						const int off = kx * step;
+						const int x0 = std::max(0, -off), x1 = std::min(w, w - off);
+						const size_t tap = (size_t)yy * w + off;
+						const float hk = kernel[ky + 2] * kernel[kx + 2];
+						float *sr = sumR.data(), *sg = sumG.data(), *sb = sumB.data(), *sw = sumW.data();
+
+						#pragma omp simd
+						for(int x = x0; x < x1; x++){
+							const size_t p = row + x, q = tap + x;
+							float dr = cr[p] - cr[q], dg = cg[p] - cg[q], db = cb[p] - cb[q];
+							float dnx = nx[p] - nx[q], dny = ny[p] - ny[q], dnz = nz[p] - nz[q];
+							float dar = ar[p] - ar[q], dag = ag[p] - ag[q], dab = ab[p] - ab[q];
+							float dz = (z[p] - z[q]) / (z[p] + 1e-3f);
+							float weight = hk * edgeStop((dr * dr + dg * dg + db * db) * invColorLocal +
+													 (dnx * dnx + dny * dny + dnz * dnz) * invNormal +
+													 (dar * dar + dag * dag + dab * dab) * invAlbedo +
+													 dz * dz * invDepth);
+							sw[x] += weight;
+							sr[x] += weight * cr[q];
+							sg[x] += weight * cg[q];
+							sb[x] += weight * cb[q];
+						}
+					}
+				}
+
+				#pragma omp simd
+				for(int x = 0; x < w; x++){
+					float inv = 1.0f / sumW[x];
+					out[0][row + x] = sumR[x] * inv;
+					out[1][row + x] = sumG[x] * inv;
+					out[2][row + x] = sumB[x] * inv;
+				}
+			}
+		});
+		img.plane[DenoiseImage::R].swap(out[0]);
+		img.plane[DenoiseImage::G].swap(out[1]);
+		img.plane[DenoiseImage::B].swap(out[2]);
+	}
+}
@@ -0,0 +1,68 @@
+// What the rays of a tile (or a pixel) touched, recorded while it is traced:
+// the objects they hit, the lights shading looked at, and a box around every
+// ray segment (origin to closest hit). Anything that changes outside of that
+// can't change the tile. For a pixel, the vertices of its paths too.
+
+struct TileDependencies{
+	std::vector<uint8_t> objects, lights; // by scene index, left empty to only keep objectBits
+	uint64_t objectBits = 0;              // bit i % 64 for object i
+	glm::vec3 lo, hi;
+	bool unbounded = false; // some ray hit nothing, so its segment has no end
+	// Per pixel only: boxes around the vertices of each group's paths, by
+	// depth. group is the traced sample's, -1 to not keep them.
+	int group = -1;
+	int vertexCount[dependencyGroups];
+	glm::vec3 vertexLo[dependencyGroups][dependencyVertices], vertexHi[dependencyGroups][dependencyVertices];
+
+	void reset(size_t objectCount, size_t lightCount){
+		objects.assign(objectCount, 0);
+		lights.assign(lightCount, 0);
+		objectBits = 0;
+		lo = glm::vec3(std::numeric_limits<float>::max());
+		hi = glm::vec3(-std::numeric_limits<float>::max());
+		unbounded = false;
+		group = -1;
+		std::fill(vertexCount, vertexCount + dependencyGroups, 0);
+	}
+	void addHit(int object, glm::vec3 from, glm::vec3 to){
+		if(!objects.empty()) objects[object] = 1;
+		objectBits |= 1ull << (object & 63);
+		lo = glm::min(lo, glm::min(from, to));
+		hi = glm::max(hi, glm::max(from, to));
+	}
+	void addMiss(){ unbounded = true; }
+	void addLight(size_t light){ if(!lights.empty()) lights[light] = 1; }
+	// Vertices come in depth order, and every sample starts again from 0.
+	void addVertex(size_t depth, glm::vec3 p){
+		if(group < 0 || depth >= (size_t)dependencyVertices) return;
+		for(; vertexCount[group] <= (int)depth; vertexCount[group]++){
+			vertexLo[group][vertexCount[group]] = p;
+			vertexHi[group][vertexCount[group]] = p;
+		}
+		vertexLo[group][depth] = glm::min(vertexLo[group][depth], p);
+		vertexHi[group][depth] = glm::max(vertexHi[group][depth], p);
+	}
+
+	// The pixel's record, vertex boxes rounded outwards to steps of lo..hi.
+	void store(PixelDependency &d) const{
+		d.objects = objectBits;
+		d.lo = lo;
+		d.hi = hi;
+		d.unbounded = unbounded;
+		const glm::vec3 extent = hi - lo;
+		const glm::vec3 scale(extent.x > 0.0f ? 255.0f / extent.x : 0.0f, extent.y > 0.0f ? 255.0f / extent.y : 0.0f,
+			extent.z > 0.0f ? 255.0f / extent.z : 0.0f);
+		for(int g = 0; g < dependencyGroups; g++){
+			d.vertices[g] = unbounded ? 0 : vertexCount[g];
+			for(int v = 0; v < d.vertices[g]; v++){
+				for(int a = 0; a < 3; a++){
+					d.path[g][v][a] = (uint8_t)std::min(std::max(std::floor((vertexLo[g][v][a] - lo[a]) * scale[a]), 0.0f), 255.0f);
+					d.path[g][v][3 + a] = (uint8_t)std::min(std::max(std::ceil((vertexHi[g][v][a] - lo[a]) * scale[a]), 0.0f), 255.0f);
+				}
+			}
+		}
+	}
+};
+
+// Set by the renderer around a tile that should be recorded, null otherwise.
+thread_local TileDependencies *recordDependencies = nullptr;
@@ -0,0 +1,78 @@
+// Minimal OpenEXR writer: single part, scanline, uncompressed, FLOAT channels.
+// Enough for compositing packages to pick up our AOVs.
+
+struct EXRChannel{
+	std::string name;
+	const float *data;
+};
+
+// Little-endian byte buffer, flushed to the file as it fills.
+struct EXRStream{
+	std::ofstream out;
+	std::string buffer;
+	uint64_t written = 0;
+	EXRStream(const char *filename) : out(filename, std::ios::binary) {}
+
+	void u8(uint8_t v){ buffer.push_back((char)v); }
+	void i32(int32_t v){ for(int b = 0; b < 4; b++) u8((uint8_t)((uint32_t)v >> (8 * b))); }
+	void u64(uint64_t v){ for(int b = 0; b < 8; b++) u8((uint8_t)(v >> (8 * b))); }
+	void f32(float v){ uint32_t bits; std::memcpy(&bits, &v, 4); i32((int32_t)bits); }
+	void str(const std::string &s){ buffer.append(s.c_str(), s.size() + 1); }
+	void attribute(const std::string &name, const std::string &type, int32_t size){ str(name); str(type); i32(size); }
+	uint64_t position() const{ return written + buffer.size(); }
+	void flush(){
+		out.write(buffer.data(), buffer.size());
+		written += buffer.size();
+		buffer.clear();
+	}
+};
+
+inline bool writeEXR(const char *filename, int width, int height, std::vector<EXRChannel> channels,
+					 const std::vector<std::pair<std::string, std::string>> &stringAttributes = {}){
+	// The spec wants channels sorted by name.
+	std::sort(channels.begin(), channels.end(), [](const EXRChannel &a, const EXRChannel &b){ return a.name < b.name; });
+	EXRStream exr(filename);
+	if(!exr.out) return false;
+
+	exr.i32(20000630);
+	exr.i32(2);
+
+	int32_t chlistSize = 1;
+	for(auto &c : channels) chlistSize += c.name.size() + 1 + 16;
+	exr.attribute("channels", "chlist", chlistSize);
+	for(auto &c : channels){
+		exr.str(c.name);
+		exr.i32(2); // FLOAT
+		exr.u8(0); exr.u8(0); exr.u8(0); exr.u8(0);
+		exr.i32(1); exr.i32(1);
+	}
+	exr.u8(0);
+	exr.attribute("compression", "compression", 1); exr.u8(0);
+	exr.attribute("dataWindow", "box2i", 16); exr.i32(0); exr.i32(0); exr.i32(width - 1); exr.i32(height - 1);
+	exr.attribute("displayWindow", "box2i", 16); exr.i32(0); exr.i32(0); exr.i32(width - 1); exr.i32(height - 1);
+	exr.attribute("lineOrder", "lineOrder", 1); exr.u8(0);
+	exr.attribute("pixelAspectRatio", "float", 4); exr.f32(1.0f);
+	exr.attribute("screenWindowCenter", "v2f", 8); exr.f32(0.0f); exr.f32(0.0f);
+	exr.attribute("screenWindowWidth", "float", 4); exr.f32(1.0f);
+	for(auto &a : stringAttributes){
+		exr.attribute(a.first, "string", a.second.size());
+		exr.buffer.append(a.second);
+	}
+	exr.u8(0);
+
+	// One scanline per chunk, so the offsets are easy to precompute.
+	const uint64_t lineBytes = (uint64_t)width * channels.size() * 4;
+	uint64_t offset = exr.position() + (uint64_t)height * 8;
+	for(int y = 0; y < height; y++, offset += 8 + lineBytes)
+		exr.u64(offset);
+
+	for(int y = 0; y < height; y++){
+		exr.i32(y);
+		exr.i32((int32_t)lineBytes);
+		for(auto &c : channels)
+			for(int x = 0; x < width; x++)
+				exr.f32(c.data[(size_t)y * width + x]);
+		exr.flush();
+	}
+	return (bool)exr.out;
+}
@@ -0,0 +1,97 @@
+// Polynomial stand-ins for libm, for the fast shading tier. No branches (only
+// selects), so loops over them vectorize. The error bounds hold over the
+// whole domain given and were measured in float against libm; what they do
+// to a whole image is what --math-report is for.
+
+inline float bitsToFloat(uint32_t u){
+	float f;
+	memcpy(&f, &u, sizeof(f));
+	return f;
+}
+inline uint32_t floatToBits(float f){
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+// Normal x > 0. Absolute error below 1e-6.
+inline float fastLog2(float x){
+	const uint32_t bits = floatToBits(x);
+	// Mantissa in [0.75, 1.5), where a degree 7 fit is enough.
+	float m = bitsToFloat((bits & 0x007fffffu) | 0x3f800000u);
+	const bool high = m >= 1.5f;
+	m = high ? m * 0.5f : m;
+	const float e = (float)((int)(bits >> 23) - 127 + high), t = m - 1.0f;
+	float p = 0.10818049f;
+	p = p * t - 0.23574317f;
+	p = p * t + 0.29980084f;
+	p = p * t - 0.36263202f;
+	p = p * t + 0.48055325f;
+	p = p * t - 0.72128444f;
+	p = p * t + 1.44269794f;
+	p = p * t - 2.6159936e-7f;
+	return e + p;
+}
+
+// x clamped to [-126, 127]. Relative error below 3e-7.
+inline float fastExp2(float x){
+	x = std::min(std::max(x, -126.0f), 127.0f);
+	const int n = (int)(x + 127.5f) - 127; // rounded, the sum is positive
+	const float f = x - (float)n;           // [-0.5, 0.5]
+	float p = 0.0013390863f;
+	p = p * f + 0.0096760319f;
+	p = p * f + 0.055503571f;
+	p = p * f + 0.24022107f;
+	p = p * f + 0.69314719f;
+	p = p * f + 1.0000001f;
+	return p * bitsToFloat((uint32_t)(n + 127) << 23);
+}
+
+// x >= 0 (pow(0, y) is 0, or 1 for y == 0). Relative error below
+// |y| * 7e-7 + 3e-7.
+inline float fastPow(float x, float y){
+	const float r = fastExp2(y * fastLog2(std::max(x, std::numeric_limits<float>::min())));
+	return x > 0.0f ? r : y == 0.0f ? 1.0f : 0.0f;
+}
+
+// x > 0. Relative error below 5e-6 (two Newton steps).
+inline float fastRsqrt(float x){
+	float y = bitsToFloat(0x5f375a86u - (floatToBits(x) >> 1));
+	y = y * (1.5f - 0.5f * x * y * y);
+	return y * (1.5f - 0.5f * x * y * y);
+}
+
+// atan2(y, x). Absolute error below 5e-6 radians.
+inline float fastAtan2(float y, float x){
+	const float ax = std::abs(x), ay = std::abs(y);
+	const float hi = std::max(ax, ay), lo = std::min(ax, ay);
+	const float t = hi > 0.0f ? lo / hi : 0.0f, t2 = t * t;
+	float r = -0.013480470f;
+	r = r * t2 + 0.057477314f;
+	r = r * t2 - 0.121239071f;
+	r = r * t2 + 0.195635925f;
+	r = r * t2 - 0.332994597f;
+	r = r * t2 + 0.999995630f;
+	r *= t;
+	r = ay > ax ? 1.57079633f - r : r;
+	r = x < 0.0f ? 3.14159265f - r : r;
+	return y < 0.0f ? -r : r;
+}
+
+// asin(x), |x| <= 1 (clamped). Absolute error below 5e-7 radians.
+inline float fastAsin(float x){
+	const float a = std::min(std::abs(x), 1.0f);
+	float p = -0.0012624911f;
+	p = p * a + 0.0066700901f;
+	p = p * a - 0.0170881256f;
+	p = p * a + 0.0308918810f;
+	p = p * a - 0.0501743046f;
+	p = p * a + 0.0889789874f;
+	p = p * a - 0.2145988016f;
+	p = p * a + 1.5707963050f;
+	const float r = 1.57079633f - std::sqrt(1.0f - a) * p;
+	return x < 0.0f ? -r : r;
+}
+
+// The tier the current thread shades with, set by the renderer around tiles.
+thread_local MathTier shadingMath = ReferenceMath;
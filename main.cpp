@@ -1,189 +1,562 @@
-#include <iostream>
-#include <vector>
-#include <algorithm>
-#include <cmath>
-#include <limits>
-#include <chrono>
-#include <fstream>
-#include <string>
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#define STBI_MSC_SECURE_CRT
+#include "renderdude.h"
+#include "denoise.h"
+#include "server.h"
 #include "stb_image_write.h"
+#include <csignal>
 
-#include <glm/glm.hpp>
-#define GLM_ENABLE_EXPERIMENTAL
-#include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtx/transform.hpp>
-#include <glm/gtx/euler_angles.hpp>
-#include <glm/gtc/constants.hpp>
-
-const int width = 1280, height = 720;
-const float samples = 4.0f;
-
-#include "criticalMath.h"
-
-bool sceneIntersection(Ray ray, std::vector<Object*> stuff, hitHistory &history){
-	float stuff_dist = std::numeric_limits<float>::max();
-	for(auto &object : stuff){
-		float dist_i = 0.0f;
-		if(object->intersect(ray, dist_i) && dist_i < stuff_dist){
-			stuff_dist = dist_i;
-			glm::vec3 hitPoint = ray.orig + ray.dir * dist_i;
-			hitHistory gotHist(dist_i, hitPoint, object->getNormal(hitPoint), object->material);
-			history = gotHist;
-		}
+RGB convertVec(glm::vec3 d){
+	return RGB(std::round(d.x * 255.0f), std::round(d.y * 255.0f), std::round(d.z * 255.0f));
+}
+
+// One number that is the whole of text, e.g. "45" or "1e9".
+template<typename T> bool parseNumber(const std::string &text, T &out){
+	std::istringstream in(text);
+	return in >> out && (in >> std::ws).eof();
+}
+
+// Comma separated floats, e.g. "4.2,0,3".
+bool parseFloats(const char *text, std::vector<float> &out, size_t count){
+	out.clear();
+	std::string list(text);
+	size_t start = 0;
+	while(start <= list.size()){
+		size_t end = std::min(list.find(',', start), list.size());
+		float value;
+		if(!parseNumber(list.substr(start, end - start), value)) return false;
+		out.push_back(value);
+		start = end + 1;
 	}
-    return stuff_dist < std::numeric_limits<float>::max();
+	return out.size() == count;
 }
 
-glm::vec3 clampRay(glm::vec3 col){
-	glm::vec3 res = col;
-	res.x = col.x < 0 ? 0 : col.x > 1 ? 1 : col.x;
-	res.y = col.y < 0 ? 0 : col.y > 1 ? 1 : col.y;
-	res.z = col.z < 0 ? 0 : col.z > 1 ? 1 : col.z;
-	return res;
+// Ctrl+C stops handing out tiles, and whatever is done gets written out.
+// A second one kills the process as usual.
+CancellationToken *interruptToken = nullptr;
+
+extern "C" void onInterrupt(int){
+	if(interruptToken) interruptToken->cancel();
+	std::signal(SIGINT, SIG_DFL);
 }
 
-glm::vec3 cast_ray(Ray ray, std::vector<Object*> stuff, std::vector<Light> lights, size_t depth = 0) {
-	float numericalMinimum = 1e-3f;
-	glm::vec3 finalColor;
-	hitHistory rayHistory;
-    if (depth > 8 || !sceneIntersection(ray, stuff, rayHistory)) {
-        return glm::vec3(0.0f, 0.0f, 0.0f); // BG color!
-    }
-	
-	glm::vec3 reflect_dir = glm::normalize(glm::reflect(ray.dir, rayHistory.normal));
-    glm::vec3 reflect_orig = glm::dot(reflect_dir, rayHistory.normal) < 0 ? rayHistory.hitPoint - rayHistory.normal * numericalMinimum : rayHistory.hitPoint + rayHistory.normal * numericalMinimum;
-    glm::vec3 reflect_color = cast_ray(Ray(reflect_orig, reflect_dir), stuff, lights, depth + 1);
-	
-	float totalDt = 0.0f, totalSpecular = 0.0f;
-	glm::vec3 lightColor;
-	for(size_t i = 0; i < lights.size(); i++){
-		glm::vec3 L = glm::normalize(lights[i].pos - rayHistory.hitPoint);
-		float lightDist = glm::length(lights[i].pos - rayHistory.hitPoint);
-		float attenuation = (1.0f + pow(lightDist / 32.0f, lights[i].intensity));
-		
-		Ray shadowRay(glm::dot(L,rayHistory.normal) < 0 ? rayHistory.hitPoint - rayHistory.normal * numericalMinimum : rayHistory.hitPoint + rayHistory.normal * numericalMinimum, L);
-		hitHistory shadowHist;
-		
-        if (sceneIntersection(shadowRay, stuff, shadowHist) && glm::length(shadowHist.hitPoint - shadowRay.orig) < lightDist){
-			continue;
-		}
-		
-		totalDt += (lights[i].intensity * std::max(0.f, glm::dot(L, rayHistory.normal))) / attenuation;
-		totalSpecular += (powf(std::max(0.0f, glm::dot(-glm::reflect(-L, rayHistory.normal), ray.dir)),rayHistory.obtMat->specualirity) * lights[i].intensity) / attenuation;
-			
-		lightColor += lights[i].color * attenuation;
+// Bounce list for --reorder: "all", or comma separated depths like "1,2,3".
+bool parseBounces(const char *text, uint32_t &mask){
+	if(!strcmp(text, "all")){
+		mask = ~0u;
+		return true;
 	}
-	switch(rayHistory.obtMat->type){
-		case Reflective:
-			finalColor = reflect_color * totalDt * rayHistory.obtMat->pbrCtrl.z * lightColor;
-			break;
-		case Checkered:
-			finalColor = rayHistory.obtMat->returnCheckered(rayHistory.hitPoint) * totalDt *
-						rayHistory.obtMat->pbrCtrl.x + (reflect_color * rayHistory.obtMat->pbrCtrl.z) 
-						+ glm::vec3(1.0f) * 
-						std::floor(totalSpecular) * 
-						rayHistory.obtMat->pbrCtrl.y * lightColor;
-			break;
-		case SphereCheckered:
-			finalColor = rayHistory.obtMat->returnSphereCheckered(rayHistory.normal) * totalDt *
-						rayHistory.obtMat->pbrCtrl.x + (reflect_color * rayHistory.obtMat->pbrCtrl.z) 
-						+ glm::vec3(1.0f) * 
-						std::floor(totalSpecular) * 
-						rayHistory.obtMat->pbrCtrl.y * lightColor;
-			break;
-		default:
-			finalColor = rayHistory.obtMat->color * totalDt * 
-						rayHistory.obtMat->pbrCtrl.x + glm::vec3(1.0f) * 
-						std::floor(totalSpecular) * 
-						rayHistory.obtMat->pbrCtrl.y * lightColor;
-			break;
+	std::vector<float> depths;
+	if(!parseFloats(text, depths, std::count(text, text + strlen(text), ',') + 1)) return false;
+	for(float d : depths){
+		if(d < 0 || d > maxTraceDepth) return false;
+		mask |= 1u << (int)d;
 	}
-	return clampRay(finalColor);
+	return true;
 }
 
-RGB convertVec(glm::vec3 d){
-	return RGB(std::round(d.x * 255.0f), std::round(d.y * 255.0f), std::round(d.z * 255.0f));
+// The scene rendered when no --scene is given; scenes/default.scene has the same.
+void defaultScene(Scene &scene){
+	int reddy = scene.addMaterial(Material(glm::vec3(0.9, 0.01, 0.1), glm::vec3(0.5f, 0.2f, 0.3f), 0.9f, Checkered), "reddy");
+	int reddySphere = scene.addMaterial(Material(glm::vec3(0.9, 0.01, 0.3), glm::vec3(0.8f, 0.3f, 0.4f), 1.2f, SphereCheckered), "reddySphere");
+	int bluey = scene.addMaterial(Material(glm::vec3(0.95, 0.8, 0.9), glm::vec3(0.2f, 0.3f, 0.5f), 6.0f, Reflective), "bluey");
+	int greeny = scene.addMaterial(Material(glm::vec3(0.8, 0.1, 0.2), glm::vec3(0.3f, 0.5f, 0.2f), 1.0f, Diffuse), "greeny");
+	int thingy = scene.addMaterial(Material(glm::vec3(0.7, 0.1, 0.1), glm::vec3(0.5f, 0.4f, 0.6f), 1.2f, Diffuse), "thingy");
+
+	scene.addSphere(glm::vec3(0.0f, -2.0f, -14.0f), 2.0f, reddySphere);
+
+	scene.addSphere(glm::vec3(5.0f, -3.0f, -15.0f), 1.2f, bluey);
+	scene.addSphere(glm::vec3(-3.0f, -3.0f, -10.0f), 1.2f, bluey);
+
+	scene.addSphere(glm::vec3(3.2f, -3.0f, -9.4f), 1.2f, bluey);
+	scene.addSphere(glm::vec3(-4.0f, -3.0f, -15.0f), 1.2f, bluey);
+	scene.addSphere(glm::vec3(-6.0f, -3.0f, -11.0f), 1.2f, bluey);
+	scene.addSphere(glm::vec3(6.0f, -3.0f, -11.0f), 1.2f, bluey);
+
+	scene.addPlane(glm::vec3(0.0f, -4.0f, -5.0f), glm::vec3(0.0f, 1.0f, 0.0f), reddy);
+	scene.addPlane(glm::vec3(0.0f, 6.0f, -5.0f), glm::vec3(0.0f, -1.0f, 0.0f), greeny);
+
+	scene.addPlane(glm::vec3(17.0f, 0.0f, -5.0f), glm::vec3(-1.0f, 0.0f, 0.0f), bluey);
+	scene.addPlane(glm::vec3(-17.0f, 0.0f, -5.0f), glm::vec3(1.0f, 0.0f, 0.0f), bluey);
+
+	scene.addPlane(glm::vec3(0.0f, 0.0f, -24.0f), glm::vec3(0.0f, 0.0f, 1.0f), thingy);
+	scene.addPlane(glm::vec3(0.0f, 0.0f, 17.0f), glm::vec3(0.0f, 0.0f, -1.0f), thingy);
+
+	scene.addLight(Light(glm::vec3(0.6f, 4.0f, 5.0f), glm::vec3(0.4f, 0.2f, 0.3f),1.0f));
+	scene.addLight(Light(glm::vec3(3.1f, 1.9f, -6.0f), glm::vec3(0.2f, 0.4f, 0.2f),1.3f));
+}
+
+// --batch: one image per line, a scene file followed by render statements
+// that override the file's, separated by ';', e.g.
+//   scenes/default.scene; size 160 90; camera 0 0 3 0 -2 -14 45; output thumb1.png
+// Lines whose scenes have the same text render from one copy of it.
+int renderManifest(const char *manifestFile, Renderer &renderer){
+   std::string manifest, line, error;
+   if(!readTextFile(manifestFile, manifest)){
+	   std::cerr << "Couldn't read " << manifestFile << std::endl;
+	   return 1;
+   }
+   std::map<std::string, std::string> files;
+   std::map<uint64_t, std::unique_ptr<Scene>> scenes;
+   std::vector<JobDescription> jobs;
+   std::vector<const Scene*> jobScenes;
+   std::istringstream lines(manifest);
+   for(int lineNumber = 1; std::getline(lines, line); lineNumber++){
+	   std::istringstream parts(line.substr(0, line.find('#')));
+	   std::string file, part, sceneText, jobText;
+	   std::getline(parts, file, ';');
+	   std::istringstream(file) >> file;
+	   if(file.find_first_not_of(" \t\r") == std::string::npos) continue;
+	   if(!files.count(file) && !readTextFile(file, files[file])){
+		   std::cerr << manifestFile << ":" << lineNumber << ": couldn't read " << file << std::endl;
+		   return 1;
+	   }
+	   std::string text = files[file];
+	   while(std::getline(parts, part, ';')) text += "\n" + part;
+	   splitDescription(text, sceneText, jobText);
+	   JobDescription job;
+	   std::unique_ptr<Scene> &scene = scenes[hashText(sceneText)];
+	   if(!scene){
+		   scene.reset(new Scene());
+		   if(!parseSceneText(sceneText, *scene, error)){
+			   std::cerr << file << ": " << error << std::endl;
+			   return 1;
+		   }
+	   }
+	   if(!parseJobText(jobText, job, error)){
+		   std::cerr << manifestFile << ":" << lineNumber << ": " << error << std::endl;
+		   return 1;
+	   }
+	   jobs.push_back(job);
+	   jobScenes.push_back(scene.get());
+   }
+
+   std::vector<FirstTouchBuffer<glm::vec3>> colors(jobs.size());
+   std::vector<BatchJob> batch(jobs.size());
+   uint64_t pixels = 0;
+   for(size_t b = 0; b < jobs.size(); b++){
+	   colors[b].resize((size_t)jobs[b].settings.width * jobs[b].settings.height);
+	   pixels += colors[b].size();
+	   batch[b].scene = jobScenes[b];
+	   batch[b].camera = jobs[b].camera();
+	   batch[b].settings = jobs[b].settings;
+	   batch[b].target.color = colors[b].data();
+   }
+   std::vector<RenderStats> stats;
+   CancellationToken cancel;
+   interruptToken = &cancel;
+   std::signal(SIGINT, onInterrupt);
+   auto start = std::chrono::steady_clock::now();
+   const std::vector<NodeWork> workBefore = renderer.pool.work();
+   bool rendered = renderer.renderBatch(batch, stats, &cancel);
+   std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+   std::signal(SIGINT, SIG_DFL);
+   interruptToken = nullptr;
+   for(size_t b = 0; b < stats.size() && !rendered; b++)
+	   if(!stats[b].error.empty()) std::cerr << "Job " << b + 1 << ": " << stats[b].error << std::endl;
+   if(!rendered) return 1;
+
+   uint64_t rays = 0;
+   int written = 0;
+   for(size_t b = 0; b < jobs.size(); b++){
+	   rays += stats[b].rays;
+	   if(stats[b].interrupted) continue;
+	   if(writePNG(jobs[b].output, jobs[b].settings.width, jobs[b].settings.height, colors[b].data())) written++;
+	   else std::cerr << "Couldn't write " << jobs[b].output << std::endl;
+   }
+   renderer.pool.report(std::cout, workBefore, renderer.pool.work());
+   std::cout << "Rendered " << written << " of " << jobs.size() << " images from " << scenes.size() << " scenes, "
+	   << pixels * 1e-6 << " Mpixels, " << rays << " rays in " << elapsed.count() << "s ("
+	   << rays / std::max(elapsed.count(), 1e-6f) * 1e-6 << " Mrays/s)" << std::endl;
+   return written == (int)jobs.size() ? 0 : 1;
 }
 
-glm::vec3 calculateWin(float fov, float x, float y){
-	float i =  (2*(x + 0.5f)/(float)width  - 1)*tan(fov/2.0f)*width/(float)height;
-    float j = -(2*(y + 0.5f)/(float)height - 1)*tan(fov/2.0f);
-	return glm::vec3(i, j, -1);
+// Renders the view again with reference settings and prints how far image
+// (rendered in seconds) is from it.
+static bool reportError(Renderer &renderer, const Scene &scene, const Camera &camera, RenderSettings reference,
+	const glm::vec3 *image, float seconds, const char *what, const char *referenceName){
+   reference.checkpointFile.clear();
+   reference.progressInterval = 0.0f;
+   const size_t pixelCount = (size_t)reference.width * reference.height;
+   FirstTouchBuffer<glm::vec3> referenceColor;
+   referenceColor.resize(pixelCount);
+   RenderTarget target;
+   target.color = referenceColor.data();
+   RenderStats stats;
+   if(!renderer.render(scene, camera, reference, target, stats)){
+	   std::cerr << stats.error << std::endl;
+	   return false;
+   }
+   ImageError e = compareImages(image, referenceColor.data(), pixelCount);
+   std::cout << what << " against " << referenceName << ": RMSE " << e.rmse << ", PSNR " << e.psnr << " dB, max error " << e.maxError << ", "
+	   << 100.0 * e.badPixels / pixelCount << "% of pixels off by more than 1/255" << std::endl;
+   std::cout << what << " took " << seconds << "s, " << referenceName << " " << stats.seconds << "s" << std::endl;
+   return true;
 }
 
-int main() {
-   RGB* data = new RGB[width * height];
-   
-   std::vector<Material> materials;
-   materials.push_back(Material(glm::vec3(0.9, 0.01, 0.1), glm::vec3(0.5f, 0.2f, 0.3f), 0.9f, Checkered));
-   materials.push_back(Material(glm::vec3(0.9, 0.01, 0.3), glm::vec3(0.8f, 0.3f, 0.4f), 1.2f, SphereCheckered));
-   materials.push_back(Material(glm::vec3(0.95, 0.8, 0.9), glm::vec3(0.2f, 0.3f, 0.5f), 6.0f, Reflective));
-   materials.push_back(Material(glm::vec3(0.8, 0.1, 0.2), glm::vec3(0.3f, 0.5f, 0.2f), 1.0f, Diffuse));
-   materials.push_back(Material(glm::vec3(0.7, 0.1, 0.1), glm::vec3(0.5f, 0.4f, 0.6f), 1.2f, Diffuse));
-   
-   materials[0].setString("reddy");
-   materials[1].setString("reddySphere");
-   materials[2].setString("bluey");
-   materials[3].setString("greeny");
-   materials[4].setString("thingy");
-   
-   std::vector<Object*> stuff;
-   stuff.push_back(new Sphere(glm::vec3(0.0f, -2.0f, -14.0f), 2.0f, materials[1]));
-   
-   stuff.push_back(new Sphere(glm::vec3(5.0f, -3.0f, -15.0f), 1.2f, materials[2]));
-   stuff.push_back(new Sphere(glm::vec3(-3.0f, -3.0f, -10.0f), 1.2f, materials[2]));
-   
-   stuff.push_back(new Sphere(glm::vec3(3.2f, -3.0f, -9.4f), 1.2f, materials[2]));
-   stuff.push_back(new Sphere(glm::vec3(-4.0f, -3.0f, -15.0f), 1.2f, materials[2]));
-   stuff.push_back(new Sphere(glm::vec3(-6.0f, -3.0f, -11.0f), 1.2f, materials[2]));
-   stuff.push_back(new Sphere(glm::vec3(6.0f, -3.0f, -11.0f), 1.2f, materials[2]));
-   
-   stuff.push_back(new Plane(glm::vec3(0.0f, -4.0f, -5.0f), glm::vec3(0.0f, 1.0f, 0.0f), materials[0]));
-   stuff.push_back(new Plane(glm::vec3(0.0f, 6.0f, -5.0f), glm::vec3(0.0f, -1.0f, 0.0f), materials[3]));
-   
-   stuff.push_back(new Plane(glm::vec3(17.0f, 0.0f, -5.0f), glm::vec3(-1.0f, 0.0f, 0.0f), materials[2]));
-   stuff.push_back(new Plane(glm::vec3(-17.0f, 0.0f, -5.0f), glm::vec3(1.0f, 0.0f, 0.0f), materials[2]));
-   
-   stuff.push_back(new Plane(glm::vec3(0.0f, 0.0f, -24.0f), glm::vec3(0.0f, 0.0f, 1.0f), materials[4]));
-   stuff.push_back(new Plane(glm::vec3(0.0f, 0.0f, 17.0f), glm::vec3(0.0f, 0.0f, -1.0f), materials[4]));
-  
-   std::vector<Light> lights;
-   lights.push_back(Light(glm::vec3(0.6f, 4.0f, 5.0f), glm::vec3(0.4f, 0.2f, 0.3f),1.0f));
-   lights.push_back(Light(glm::vec3(3.1f, 1.9f, -6.0f), glm::vec3(0.2f, 0.4f, 0.2f),1.3f));
-
-   float fov = glm::pi<float>() / 4.0f;
-   auto timeThen = std::chrono::system_clock::now(), timeNow = std::chrono::system_clock::now();
-   float elapsedTime = 0.0f;
-   #pragma omp parallel for schedule(dynamic)
-   for(int i = 0; i < width;  i++){
-	   for(int j = 0; j < height; j++){
-		   timeNow = std::chrono::system_clock::now();
-		   std::chrono::duration<float> deltaChrono = timeNow - timeThen;
-		   timeThen = timeNow;
-		   float deltaTime = deltaChrono.count();
-		
-		   int currentPos = i + j * width;
-		   
-		   glm::mat3 rotMat = glm::rotate(glm::radians(15.0f), glm::vec3(0.0, 1.0, 0.0));
-		   glm::vec3 finalResult;
-		   for(int sample = 0; sample < samples; sample++){
-			    float sampleX = (i + 0.5f + ((sample < 2) ? -0.25f : 0.25f)); 
-                float sampleY = (j + 0.5f + ((sample >= 2) ? -0.25f : 0.25f));
-				glm::vec3 dir = rotMat * glm::normalize(calculateWin(fov, sampleX, sampleY));
-				Ray currentRay(glm::vec3(4.2, 0.0, 3.0), dir);
-				finalResult += cast_ray(currentRay, stuff, lights);
+// Renders the view with each way of splitting the hierarchy, built from
+// scratch, and prints what each costs to build against what it saves tracing.
+// Full builds are traversed in both layouts.
+static bool reportBvhSplits(Renderer &renderer, const Scene &scene, const Camera &camera, RenderSettings settings){
+   settings.checkpointFile.clear();
+   settings.progressInterval = 0.0f;
+   FirstTouchBuffer<glm::vec3> color;
+   color.resize((size_t)settings.width * settings.height);
+   RenderTarget target;
+   target.color = color.data();
+   const char *names[] = {"median", "sah", "morton"}, *layouts[] = {"binary", "wide"};
+   for(BvhSplit split : {MedianSplit, SahSplit, MortonSplit})
+	   for(BvhLayout layout : {BinaryBvh, WideBvh}){
+		   if(layout == WideBvh && settings.bvh != FullBvh) continue;
+		   settings.bvhSplit = split;
+		   settings.bvhLayout = layout;
+		   RenderStats stats;
+		   if(!renderer.render(scene, camera, settings, target, stats)){
+			   std::cerr << stats.error << std::endl;
+			   return false;
 		   }
-           finalResult /= samples;
-		   data[currentPos] = convertVec(finalResult);
-		   
-		   elapsedTime += deltaTime;
+		   std::cout << "BVH " << names[split] << " " << layouts[layout] << ": built in " << stats.bvhSeconds << "s, SAH cost " << stats.bvhSahCost << ", "
+			   << (double)stats.bvhNodeBytes / std::max<size_t>(stats.bvhPrimitives, 1) << " bytes of nodes per object, rendered in "
+			   << stats.seconds << "s (" << stats.rays / std::max(stats.seconds, 1e-6f) * 1e-6 << " Mrays/s)" << std::endl;
 	   }
+   return true;
+}
+
+int main(int argc, char **argv) {
+   // --scene swaps the built-in scene and defaults for a file's, the other
+   // options still apply on top.
+   std::string sceneFile, sceneText, outputFile = "render.png", error;
+   JobDescription description;
+   for(int arg = 1; arg + 1 < argc; arg++)
+	   if(!strcmp(argv[arg], "--scene")) sceneFile = argv[arg + 1];
+   if(!sceneFile.empty()){
+	   std::string text, jobText;
+	   if(!readTextFile(sceneFile, text)){
+		   std::cerr << "Couldn't read " << sceneFile << std::endl;
+		   return 1;
+	   }
+	   splitDescription(text, sceneText, jobText);
+	   if(!parseJobText(jobText, description, error)){
+		   std::cerr << sceneFile << ": " << error << std::endl;
+		   return 1;
+	   }
+	   outputFile = description.output;
+   }
+   RenderSettings settings = description.settings;
+   settings.checkpointFile = "render.ckpt";
+   settings.progressInterval = 1.0f;
+   bool denoiseOutput = false, rayStats = false, shadowReport = false, mathReport = false, bvhReport = false;
+   int threadCount = 0;
+   PinMode pinMode = PinNode;
+   float fov = glm::pi<float>() / 4.0f, orthoHeight = 0.0f;
+   glm::vec3 eye(4.2f, 0.0f, 3.0f);
+   glm::vec3 target = eye + glm::mat3(glm::rotate(glm::radians(15.0f), glm::vec3(0.0, 1.0, 0.0))) * glm::vec3(0.0f, 0.0f, -1.0f);
+   glm::vec2 depthOfField;
+   if(!sceneFile.empty()){
+	   fov = glm::radians(description.fov);
+	   orthoHeight = description.orthoHeight;
+	   eye = description.eye;
+	   target = description.target;
+	   depthOfField = description.depthOfField;
    }
-   
-   stbi_write_png("render.png", width, height, 3, data, 0);
+   std::vector<float> values;
+   unsigned aovMask = 0;
+   int moveObject = -1;
+   glm::vec3 movedTo;
+   std::string servePath, serveOutput = ".", sendPath, sendRequestText, batchManifest;
+   double rayBudget;
+   auto badValue = [](const char *option, const char *value){
+	   std::cerr << "Bad value for " << option << ": " << value << std::endl;
+	   return 1;
+   };
+   for(int arg = 1; arg < argc; arg++){
+	   if(!strcmp(argv[arg], "--denoise")) denoiseOutput = true;
+	   else if(!strcmp(argv[arg], "--aov") && arg + 1 < argc){
+		   if(!parseAOVList(argv[++arg], aovMask)){
+			   std::cerr << "Unknown AOV in " << argv[arg] << std::endl;
+			   return 1;
+		   }
+	   }
+	   else if(!strcmp(argv[arg], "--resume")) settings.resume = true;
+	   else if(!strcmp(argv[arg], "--wavefront")) settings.wavefront = true;
+	   else if(!strcmp(argv[arg], "--reorder") && arg + 1 < argc){
+		   if(!parseBounces(argv[++arg], settings.reorderMask)){
+			   std::cerr << "Bad bounce list " << argv[arg] << std::endl;
+			   return 1;
+		   }
+		   settings.wavefront = true;
+	   }
+	   else if(!strcmp(argv[arg], "--raster")) settings.rasterPrimary = true;
+	   else if(!strcmp(argv[arg], "--shadow-maps") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], settings.shadowMapResolution)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--shadow-bias") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], settings.shadowMapBias)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--shadow-report")) shadowReport = true;
+	   else if(!strcmp(argv[arg], "--math") && arg + 1 < argc){
+		   if(!parseMathTier(argv[++arg], settings.math)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--math-report")) mathReport = true;
+	   else if(!strcmp(argv[arg], "--sampler") && arg + 1 < argc){
+		   if(!parseSamplerType(argv[++arg], settings.sampler)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--blue-noise")) settings.blueNoise = true;
+	   else if(!strcmp(argv[arg], "--bvh") && arg + 1 < argc){
+		   if(!parseBvhBuild(argv[++arg], settings.bvh)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--bvh-split") && arg + 1 < argc){
+		   if(!parseBvhSplit(argv[++arg], settings.bvhSplit)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--bvh-layout") && arg + 1 < argc){
+		   if(!parseBvhLayout(argv[++arg], settings.bvhLayout)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--bvh-report")) bvhReport = true;
+	   else if(!strcmp(argv[arg], "--bvh-cache") && arg + 1 < argc) settings.bvhCache = argv[++arg];
+	   else if(!strcmp(argv[arg], "--ray-stats")) rayStats = true;
+	   else if(!strcmp(argv[arg], "--threads") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], threadCount)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--pin") && arg + 1 < argc){
+		   std::string mode = argv[++arg];
+		   if(mode == "none") pinMode = PinNone;
+		   else if(mode == "node") pinMode = PinNode;
+		   else if(mode == "core") pinMode = PinCore;
+		   else { std::cerr << "Unknown pin mode " << mode << std::endl; return 1; }
+	   }
+	   else if(!strcmp(argv[arg], "--progress-interval") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], settings.progressInterval)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--progress-json") && arg + 1 < argc) settings.progressJson = argv[++arg];
+	   else if(!strcmp(argv[arg], "--time-budget") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], settings.timeBudget) || settings.timeBudget < 0.0f) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--ray-budget") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], rayBudget) || !(rayBudget >= 0.0 && rayBudget < 18446744073709551616.0)) return badValue(argv[arg - 1], argv[arg]);
+		   settings.rayBudget = (uint64_t)rayBudget;
+	   }
+	   else if(!strcmp(argv[arg], "--progressive")) settings.progressive = true;
+	   else if(!strcmp(argv[arg], "--snapshot-passes") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], settings.snapshotPasses)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--snapshot-interval") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], settings.snapshotInterval)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--checkpoint-interval") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], settings.checkpointInterval)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--look-at") && arg + 1 < argc){
+		   if(!parseFloats(argv[++arg], values, 6)) return badValue(argv[arg - 1], argv[arg]);
+		   eye = glm::vec3(values[0], values[1], values[2]);
+		   target = glm::vec3(values[3], values[4], values[5]);
+	   }
+	   else if(!strcmp(argv[arg], "--fov") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], fov)) return badValue(argv[arg - 1], argv[arg]);
+		   fov = glm::radians(fov);
+	   }
+	   else if(!strcmp(argv[arg], "--dof") && arg + 1 < argc){
+		   if(!parseFloats(argv[++arg], values, 2)) return badValue(argv[arg - 1], argv[arg]);
+		   depthOfField = glm::vec2(values[0], values[1]);
+	   }
+	   else if(!strcmp(argv[arg], "--ortho") && arg + 1 < argc){
+		   if(!parseNumber(argv[++arg], orthoHeight)) return badValue(argv[arg - 1], argv[arg]);
+	   }
+	   else if(!strcmp(argv[arg], "--scene") && arg + 1 < argc) arg++;
+	   else if(!strcmp(argv[arg], "--move") && arg + 2 < argc){
+		   if(!parseNumber(argv[arg + 1], moveObject) || moveObject < 0) return badValue(argv[arg], argv[arg + 1]);
+		   if(!parseFloats(argv[arg + 2], values, 3)) return badValue(argv[arg], argv[arg + 2]);
+		   movedTo = glm::vec3(values[0], values[1], values[2]);
+		   arg += 2;
+	   }
+	   else if(!strcmp(argv[arg], "--tile-cache") && arg + 1 < argc) settings.tileCache = argv[++arg];
+	   else if(!strcmp(argv[arg], "--batch") && arg + 1 < argc) batchManifest = argv[++arg];
+	   else if(!strcmp(argv[arg], "--serve") && arg + 1 < argc) servePath = argv[++arg];
+	   else if(!strcmp(argv[arg], "--output-dir") && arg + 1 < argc) serveOutput = argv[++arg];
+	   else if(!strcmp(argv[arg], "--send") && arg + 2 < argc){
+		   sendPath = argv[++arg];
+		   sendRequestText = argv[++arg];
+	   }
+	   else { std::cerr << "Unknown option " << argv[arg] << std::endl; return 1; }
+   }
+   if(settings.isProgressive() && settings.resume){
+	   std::cerr << "--resume can't be combined with progressive rendering" << std::endl;
+	   return 1;
+   }
+   if(!sendPath.empty()){
+	   std::string request = sendRequestText, reply;
+	   if(request != "metrics" && request != "shutdown" && !readTextFile(sendRequestText, request)){
+		   std::cerr << "Couldn't read " << sendRequestText << std::endl;
+		   return 1;
+	   }
+	   if(!sendRequest(sendPath, request, reply)){
+		   std::cerr << "No server on " << sendPath << std::endl;
+		   return 1;
+	   }
+	   std::cout << reply;
+	   return reply.compare(0, 5, "error") ? 0 : 1;
+   }
+   if(!batchManifest.empty()){
+	   Renderer renderer(threadCount, pinMode);
+	   return renderManifest(batchManifest.c_str(), renderer);
+   }
+   if(!servePath.empty()){
+	   Renderer renderer(threadCount, pinMode);
+	   RenderServer server(renderer);
+	   server.outputDirectory = serveOutput;
+	   return server.serve(servePath) ? 0 : 1;
+   }
+   const int width = settings.width, height = settings.height;
+
+   Scene scene;
+   if(sceneFile.empty()) defaultScene(scene);
+   else if(!parseSceneText(sceneText, scene, error)){
+	   std::cerr << sceneFile << ": " << error << std::endl;
+	   return 1;
+   }
+
+   Camera camera = Camera::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f), fov, width, height);
+   if(orthoHeight > 0.0f) camera.setOrthographic(orthoHeight);
+   if(depthOfField.x > 0.0f) camera.setDepthOfField(depthOfField.x, depthOfField.y);
+
+   // Left untouched here so the renderer's workers place the pages.
+   FirstTouchBuffer<glm::vec3> color;
+   FirstTouchBuffer<GBufferSample> guide;
+   std::vector<int> pixelSamples(width * height);
+   color.resize((size_t)width * height);
+   if(denoiseOutput || aovMask) guide.resize((size_t)width * height);
+   RenderTarget renderTarget;
+   renderTarget.color = color.data();
+   renderTarget.guide = guide.data();
+   renderTarget.sampleCount = pixelSamples.data();
+
+   if(moveObject >= (int)scene.objects.size()){
+	   std::cerr << "No object " << moveObject << " to move" << std::endl;
+	   return 1;
+   }
+   std::vector<PixelDependency> dependencies;
+   if(moveObject >= 0){
+	   dependencies.resize((size_t)width * height);
+	   renderTarget.dependencies = dependencies.data();
+   }
+
+   if(settings.rasterPrimary && !camera.isPinhole())
+	   std::cerr << "--raster needs a pinhole camera, tracing primary rays instead" << std::endl;
+
+   Renderer renderer(threadCount, pinMode);
+   RenderStats stats;
+   CancellationToken cancel;
+   interruptToken = &cancel;
+   std::signal(SIGINT, onInterrupt);
+   // The node report covers this render only, not --move's or the reports' passes.
+   const std::vector<NodeWork> workBefore = renderer.pool.work();
+   bool rendered = renderer.render(scene, camera, settings, renderTarget, stats, &cancel);
+   const std::vector<NodeWork> workAfter = renderer.pool.work();
+   std::signal(SIGINT, SIG_DFL);
+   interruptToken = nullptr;
+   if(!rendered){
+	   std::cerr << stats.error << std::endl;
+	   return 1;
+   }
+
+   // --move: edit the scene and retrace only the pixels that can see the change.
+   if(moveObject >= 0 && !stats.interrupted){
+	   std::vector<uint8_t> retrace((size_t)width * height, 0);
+	   float fullSeconds = stats.seconds;
+	   size_t hitBefore = 0;
+	   for(const PixelDependency &d : dependencies) hitBefore += d.objects >> (moveObject & 63) & 1;
+	   scene.moveObject(moveObject, movedTo);
+	   size_t affected = markAffected(dependencies.data(), retrace.size(), moveObject, *scene.objects[moveObject], scene.lights, retrace.data());
+	   renderTarget.retrace = retrace.data();
+	   if(!renderer.render(scene, camera, settings, renderTarget, stats)){
+		   std::cerr << stats.error << std::endl;
+		   return 1;
+	   }
+	   std::cout << "Pixel dependencies: " << dependencies.size() * sizeof(PixelDependency) / (1024.0 * 1024.0) << " MB ("
+		   << sizeof(PixelDependency) << " bytes per pixel)" << std::endl;
+	   std::cout << "Moving object " << moveObject << " retraced " << affected << " pixels (" << hitBefore << " had hit it), "
+		   << 100.0 * affected / retrace.size() << "% of the image in " << stats.seconds << "s, the full render took " << fullSeconds << "s" << std::endl;
+   }
+   if(settings.bvh != NoBvh)
+	   std::cout << "BVH: " << stats.bvhPrimitives << " objects, " << stats.bvhNodes << " nodes (" << (double)stats.bvhNodeBytes / std::max<size_t>(stats.bvhPrimitives, 1) << " bytes per object traversed), " << stats.bvhSeconds << "s before the first ray"
+		   << (stats.bvhLoaded ? " (loaded from " + settings.bvhCache + ")" : stats.bvhCacheStale ? " (rebuilt, the cached one was stale)" : "")
+		   << ", SAH cost " << stats.bvhSahCost << "; " << stats.bvhUnsplitPrimitives << " objects in " << stats.bvhUnsplitNodes << " subtrees no ray reached" << std::endl;
+   std::cout << "First tile done " << stats.firstTileSeconds << "s after the render started" << std::endl;
+   if(settings.shadowMapResolution > 0)
+	   std::cout << "Shadow maps: " << scene.lights.size() << " lights at " << settings.shadowMapResolution << "^2 per face, "
+		   << stats.shadowMapBytes / (1024.0 * 1024.0) << " MB, built in " << stats.shadowMapSeconds << "s" << std::endl;
+
+   // --shadow-report and --math-report: the same view without the
+   // approximation, as the reference.
+   if(shadowReport && settings.shadowMapResolution > 0 && !stats.interrupted){
+	   RenderSettings reference = settings;
+	   reference.shadowMapResolution = 0;
+	   if(!reportError(renderer, scene, camera, reference, color.data(), stats.seconds + stats.shadowMapSeconds, "Shadow maps", "shadow rays"))
+		   return 1;
+   }
+   if(mathReport && settings.math != ReferenceMath && !stats.interrupted){
+	   RenderSettings reference = settings;
+	   reference.math = ReferenceMath;
+	   if(!reportError(renderer, scene, camera, reference, color.data(), stats.seconds, "Fast math", "reference math"))
+		   return 1;
+   }
+   if(bvhReport && settings.bvh != NoBvh && !stats.interrupted && !reportBvhSplits(renderer, scene, camera, settings))
+	   return 1;
+   if(settings.resume){
+	   if(stats.restoredTiles < 0)
+		   std::cerr << "No matching checkpoint to resume from, started over" << std::endl;
+	   else
+		   std::cout << "Resumed with " << stats.restoredTiles << " of " << stats.tileCount << " tiles done" << std::endl;
+   }
+   if(settings.isProgressive())
+	   std::cout << "Rendered " << stats.passes << " passes (" << stats.minSamples << " to " << stats.maxSamples << " samples per pixel)" << std::endl;
+   if(!settings.tileCache.empty())
+	   std::cout << "Reused " << stats.cachedTiles << " of " << stats.tileCount << " tiles from " << settings.tileCache << std::endl;
+   if(stats.snapshots)
+	   std::cout << "Wrote " << stats.snapshots << " snapshots to " << settings.snapshotFile << std::endl;
+   if(stats.interrupted)
+	   std::cout << "Interrupted, writing what is done so far." << (settings.checkpointFile.empty() ? "" : " Use --resume to finish it.") << std::endl;
+   renderer.pool.report(std::cout, workBefore, workAfter);
+
+   RGB* data = new RGB[width * height];
+   DenoiseImage *denoiseImage = denoiseOutput ? new DenoiseImage(width, height) : nullptr;
+   AOVBuffers *aovs = aovMask ? new AOVBuffers(aovMask, width, height) : nullptr;
+   for(int p = 0; p < width * height; p++){
+	   data[p] = convertVec(color[p]);
+	   if(denoiseImage)
+		   denoiseImage->setPixel(p, color[p], guide[p]);
+	   if(aovs)
+		   aovs->setPixel(p, color[p], guide[p], pixelSamples[p]);
+   }
+
+   if(denoiseImage){
+	   auto denoiseStart = std::chrono::steady_clock::now();
+	   denoise(*denoiseImage, DenoiseSettings(), renderer.pool);
+	   std::chrono::duration<float> denoiseTime = std::chrono::steady_clock::now() - denoiseStart;
+	   for(int p = 0; p < width * height; p++)
+		   data[p] = convertVec(glm::clamp(denoiseImage->color(p), 0.0f, 1.0f));
+	   delete denoiseImage;
+	   std::cout << "Denoising took: " << denoiseTime.count() << std::endl;
+   }
+
+   if(aovs){
+	   if(!aovs->write("render.exr", scene.materials))
+		   std::cerr << "Couldn't write render.exr" << std::endl;
+	   delete aovs;
+   }
+
+   if(rayStats && settings.wavefront)
+	   for(size_t d = 0; d < stats.bounces.size(); d++){
+		   const BounceStats &b = stats.bounces[d];
+		   if(!b.rays) continue;
+		   std::cout << "Bounce " << d << (settings.reorderMask >> d & 1 ? " (reordered)" : "") << ": " << b.rays << " rays, "
+			   << b.shadowRays << " shadow rays, extend " << b.seconds << "s, "
+			   << (b.rays + b.shadowRays) / std::max(b.seconds, 1e-9) * 1e-6 << " Mrays/s" << std::endl;
+	   }
+
+   stbi_write_png(outputFile.c_str(), width, height, 3, data, 0);
+   if(!stats.interrupted && !settings.checkpointFile.empty()) std::remove(settings.checkpointFile.c_str());
    delete[] data;
-   std::cout << "Total time taken to render: " << elapsedTime << std::endl;
+   // Shadow maps are built before the render starts, but are part of its cost.
+   std::cout << "Total time taken to render: " << stats.seconds + stats.shadowMapSeconds;
+   if(settings.shadowMapResolution > 0) std::cout << " (" << stats.shadowMapSeconds << "s of it building shadow maps)";
+   std::cout << std::endl;
    return 0;
-}
\ No newline at end of file
+}
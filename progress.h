@@ -0,0 +1,131 @@
+// Live progress: tiles/pixels done, rays per second and an ETA, printed to
+// stderr and optionally written as newline-delimited JSON.
+//
+// Every worker owns a cache-line sized slot it alone writes, so the render
+// threads never share a counter. The reporter thread just sums the slots.
+
+struct alignas(64) ProgressSlot{
+	std::atomic<uint64_t> tiles{0}, pixels{0}, rays{0};
+};
+
+struct ProgressCounters{
+	std::unique_ptr<ProgressSlot[]> slots;
+	int slotCount;
+
+	ProgressCounters(int workers) : slots(new ProgressSlot[workers]), slotCount(workers) {}
+
+	// Only ever called by the worker that owns the slot, so a plain load and
+	// store is enough.
+	void add(int worker, uint64_t tiles, uint64_t pixels, uint64_t rays){
+		ProgressSlot &slot = slots[worker];
+		slot.tiles.store(slot.tiles.load(std::memory_order_relaxed) + tiles, std::memory_order_relaxed);
+		slot.pixels.store(slot.pixels.load(std::memory_order_relaxed) + pixels, std::memory_order_relaxed);
+		slot.rays.store(slot.rays.load(std::memory_order_relaxed) + rays, std::memory_order_relaxed);
+	}
+
+	void sum(uint64_t &tiles, uint64_t &pixels, uint64_t &rays) const{
+		tiles = pixels = rays = 0;
+		for(int w = 0; w < slotCount; w++){
+			tiles += slots[w].tiles.load(std::memory_order_relaxed);
+			pixels += slots[w].pixels.load(std::memory_order_relaxed);
+			rays += slots[w].rays.load(std::memory_order_relaxed);
+		}
+	}
+};
+
+struct ProgressReporter{
+	const ProgressCounters &counters;
+	uint64_t totalTiles, totalPixels, startTiles, startPixels;
+	float interval;
+	// Budgeted renders go until time or rays run out, so progress is measured
+	// against whichever budget is closer to being spent.
+	float timeBudget = 0.0f;
+	uint64_t rayBudget = 0;
+	FILE *json = nullptr;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	// startTiles/startPixels are already done (resumed) and don't count
+	// towards the rate. jsonPath may be empty, or "-" for stdout.
+	ProgressReporter(const ProgressCounters &c, uint64_t tiles, uint64_t pixels, uint64_t doneTiles, uint64_t donePixels,
+		float seconds, const std::string &jsonPath) :
+		counters(c), totalTiles(tiles), totalPixels(pixels), startTiles(doneTiles), startPixels(donePixels), interval(seconds) {
+		if(jsonPath == "-") json = stdout;
+		else if(!jsonPath.empty() && !(json = fopen(jsonPath.c_str(), "w")))
+			std::cerr << "Couldn't open " << jsonPath << std::endl;
+		if(interval > 0.0f || json)
+			worker = std::thread([this]{ run(); });
+	}
+	~ProgressReporter(){ stop(); }
+
+	float elapsed() const{
+		return std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void report(bool done){
+		uint64_t tiles, pixels, rays;
+		counters.sum(tiles, pixels, rays);
+		tiles += startTiles;
+		pixels += startPixels;
+		float seconds = elapsed();
+		double pixelRate = (pixels - startPixels) / std::max(seconds, 1e-6f);
+		double rayRate = rays / std::max(seconds, 1e-6f);
+		double eta = done ? 0.0 : pixelRate > 0.0 ? (totalPixels - pixels) / pixelRate : -1.0;
+		double fraction = totalPixels ? (double)pixels / totalPixels : 1.0;
+		if(timeBudget > 0.0f || rayBudget){
+			fraction = std::max(timeBudget > 0.0f ? seconds / timeBudget : 0.0, rayBudget ? (double)rays / rayBudget : 0.0);
+			fraction = std::min(fraction, 1.0);
+			eta = done ? 0.0 : fraction > 0.0 ? seconds * (1.0 - fraction) / fraction : -1.0;
+		}
+
+		if(interval > 0.0f){
+			char line[160];
+			int percent = (int)(100 * fraction);
+			char count[64], remaining[32] = "--:--";
+			if(timeBudget > 0.0f || rayBudget)
+				snprintf(count, sizeof(count), "pass %llu", (unsigned long long)((tiles + totalTiles - 1) / std::max<uint64_t>(totalTiles, 1)));
+			else
+				snprintf(count, sizeof(count), "%llu/%llu tiles", (unsigned long long)tiles, (unsigned long long)totalTiles);
+			if(eta >= 0.0)
+				snprintf(remaining, sizeof(remaining), "%d:%02d", (int)eta / 60, (int)eta % 60);
+			snprintf(line, sizeof(line), "\r%3d%%  %s  %.2f Mrays/s  ETA %s   ", percent, count, rayRate * 1e-6, remaining);
+			std::cerr << line << (done ? "\n" : "") << std::flush;
+		}
+		if(json){
+			fprintf(json, "{\"elapsed\":%.3f,\"tiles_done\":%llu,\"tiles_total\":%llu,\"pixels_done\":%llu,\"pixels_total\":%llu,"
+				"\"rays\":%llu,\"rays_per_sec\":%.0f,\"eta\":%.3f,\"done\":%s}\n", seconds,
+				(unsigned long long)tiles, (unsigned long long)totalTiles, (unsigned long long)pixels, (unsigned long long)totalPixels,
+				(unsigned long long)rays, rayRate, eta, done ? "true" : "false");
+			fflush(json);
+		}
+	}
+
+	void run(){
+		const float period = interval > 0.0f ? interval : 1.0f;
+		std::unique_lock<std::mutex> lock(mutex);
+		while(!wake.wait_for(lock, std::chrono::duration<float>(period), [this]{ return stopping; })){
+			lock.unlock();
+			report(false);
+			lock.lock();
+		}
+	}
+
+	// Stops the reporter and emits the final line.
+	void stop(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(stopping) return;
+			stopping = true;
+		}
+		wake.notify_all();
+		if(worker.joinable()){
+			worker.join();
+			report(true);
+		}
+		if(json && json != stdout) fclose(json);
+		json = nullptr;
+	}
+};
@@ -0,0 +1,115 @@
+// Progressive rendering: one sample per pixel per pass over the whole frame,
+// summed into a float accumulation buffer, so a full (noisy) picture exists
+// after the first pass and refines from there.
+
+struct AccumulationBuffer{
+	int width, height;
+	std::vector<glm::vec3> colorSum;
+	std::vector<GBufferSample> guideSum;
+	std::vector<int> tilePasses; // passes each tile has finished
+
+	AccumulationBuffer(int w, int h, int tileCount, bool withGuide) : width(w), height(h) {
+		colorSum.resize((size_t)w * h);
+		if(withGuide) guideSum.resize((size_t)w * h);
+		tilePasses.resize(tileCount, 0);
+	}
+
+	void add(int pixel, glm::vec3 color, const GBufferSample *guide){
+		colorSum[pixel] += color;
+		if(guide && !guideSum.empty()) guideSum[pixel].accumulate(*guide, 1.0f);
+	}
+
+	// Averages into frame (and samples, the per pixel count, if given). A pass
+	// cut short leaves some tiles one sample ahead of the rest.
+	void resolve(FrameState &frame, int *samples) const{
+		for(int tile = 0; tile < frame.tileCount; tile++){
+			int x0, y0, x1, y1, n = tilePasses[tile];
+			frame.tileBounds(tile, x0, y0, x1, y1);
+			for(int j = y0; j < y1; j++)
+				for(int i = x0; i < x1; i++){
+					int p = i + j * width;
+					if(samples) samples[p] = n;
+					if(!n) continue;
+					frame.color[p] = colorSum[p] / (float)n;
+					if(frame.guide && !guideSum.empty()){
+						frame.guide[p] = GBufferSample();
+						frame.guide[p].accumulate(guideSum[p], 1.0f / n);
+					}
+				}
+		}
+	}
+
+	// 8-bit copy of the current average, for snapshots.
+	void resolve(std::vector<RGB> &image, const FrameState &frame) const{
+		image.resize((size_t)width * height);
+		for(int tile = 0; tile < frame.tileCount; tile++){
+			int x0, y0, x1, y1, n = tilePasses[tile];
+			frame.tileBounds(tile, x0, y0, x1, y1);
+			float scale = n ? 255.0f / n : 0.0f;
+			for(int j = y0; j < y1; j++)
+				for(int i = x0; i < x1; i++){
+					glm::vec3 c = glm::clamp(colorSum[i + j * width] * scale, 0.0f, 255.0f);
+					image[i + j * width] = RGB(std::round(c.x), std::round(c.y), std::round(c.z));
+				}
+		}
+	}
+};
+
+// Encodes snapshots on its own thread so passes don't wait on PNG
+// compression. Only the newest image matters: one submitted while the last
+// is still being encoded replaces whatever was waiting.
+struct SnapshotWriter{
+	std::string filename;
+	int width, height;
+	std::vector<RGB> pending;
+	bool hasPending = false, stopping = false;
+	int written = 0;
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	SnapshotWriter(const std::string &name, int w, int h) : filename(name), width(w), height(h) {
+		worker = std::thread([this]{ run(); });
+	}
+	~SnapshotWriter(){ stop(); }
+
+	// Takes the image (leaves image with the previous pending buffer).
+	void submit(std::vector<RGB> &image){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			std::swap(pending, image);
+			hasPending = true;
+		}
+		wake.notify_all();
+	}
+
+	void run(){
+		std::vector<RGB> image;
+		std::unique_lock<std::mutex> lock(mutex);
+		for(;;){
+			wake.wait(lock, [this]{ return hasPending || stopping; });
+			if(!hasPending) return;
+			std::swap(image, pending);
+			hasPending = false;
+			lock.unlock();
+			// Rename last so a viewer never picks up a half-written file.
+			std::string temp = filename + ".tmp.png";
+			bool ok = stbi_write_png(temp.c_str(), width, height, 3, image.data(), 0) != 0;
+			std::remove(filename.c_str());
+			ok = ok && std::rename(temp.c_str(), filename.c_str()) == 0;
+			if(!ok) std::cerr << "Couldn't write snapshot " << filename << std::endl;
+			lock.lock();
+			written++;
+		}
+	}
+
+	// Writes whatever is still pending, then stops.
+	void stop(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		if(worker.joinable()) worker.join();
+	}
+};
@@ -0,0 +1,177 @@
+// Primary visibility by rasterization, for pinhole cameras, whose primary
+// rays all start at one point. Each frame first bins the objects into the
+// tiles their screen footprints overlap, nearest first. A tile then draws its
+// objects in that order into a visibility buffer, each over just the pixels
+// its footprint covers. The depth test uses the object's own intersect() on
+// the sample's ray, skipped when the object can't come closer than what the
+// sample already hit, and ties go to the earlier object in the scene, so the
+// buffer ends up holding exactly the hits sceneIntersection would find.
+//
+// Spheres cover the projection of their bounding box, grown by what
+// intersect()'s rounding can add, planes the half of the screen that looks at
+// the side the camera is on. Both get some slack, and intersect() decides
+// the samples near the edges.
+
+struct PrimaryHit{
+	int object = -1; // -1 if the ray hits nothing
+	float dist = std::numeric_limits<float>::max();
+};
+
+// Pixels of slack around a sphere's box, for the rounding in projecting it.
+const float rasterSlack = 0.05f;
+
+// Where on screen (in raster coordinates) an object can show up.
+struct Footprint{
+	enum Kind{Everywhere, Nowhere, Rect, HalfPlane} kind = Everywhere;
+	float x0, y0, x1, y1; // Rect
+	float a, b, c;        // HalfPlane: a + b * x + c * y >= 0
+	float near = 0.0f;    // no hit of the object's is closer to the camera
+
+	bool covers(float x, float y) const{
+		if(kind == Rect) return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+		if(kind == HalfPlane) return a + b * x + c * y >= 0.0f;
+		return kind == Everywhere;
+	}
+	bool overlaps(float bx0, float by0, float bx1, float by1) const{
+		if(kind == Rect) return x0 <= bx1 && x1 >= bx0 && y0 <= by1 && y1 >= by0;
+		if(kind == HalfPlane) return a + b * (b > 0.0f ? bx1 : bx0) + c * (c > 0.0f ? by1 : by0) >= 0.0f;
+		return kind == Everywhere;
+	}
+};
+
+inline Footprint footprint(const Camera &camera, const Object *object){
+	Footprint f;
+	if(const Sphere *sphere = dynamic_cast<const Sphere*>(object)){
+		// intersect() rounds: its d2 can come out short by ~4e-7 of the
+		// squared distance to the center, so it can hit rays passing up to
+		// 2e-7 * distance^2 / radius outside the sphere, and report the hit up
+		// to ~7e-4 of the distance early. The box and near allow for both.
+		const float toCenter = glm::length(sphere->pos - camera.origin), rounding = 1e-5f * (glm::length(sphere->pos) + glm::length(camera.origin));
+		const float r = sphere->radius + 1e-6f * toCenter * toCenter / sphere->radius + rounding;
+		// Every primary ray heads forward, so a sphere wholly behind the camera
+		// is never hit. The corners of the bounding box have to be in front
+		// of it to be projected.
+		const float ahead = glm::dot(sphere->pos - camera.origin, camera.forward);
+		if(ahead < -r - 1e-3f) f.kind = Footprint::Nowhere;
+		if(ahead <= r * 1.7321f + 1e-3f) return f;
+		f.kind = Footprint::Rect;
+		f.near = toCenter - sphere->radius - 1e-3f * toCenter - rounding;
+		f.x0 = f.y0 = std::numeric_limits<float>::max();
+		f.x1 = f.y1 = -std::numeric_limits<float>::max();
+		for(int corner = 0; corner < 8; corner++){
+			glm::vec3 p = sphere->pos + glm::vec3(corner & 1 ? r : -r, corner & 2 ? r : -r, corner & 4 ? r : -r);
+			glm::vec2 raster = camera.project(p);
+			f.x0 = std::min(f.x0, raster.x - rasterSlack);
+			f.y0 = std::min(f.y0, raster.y - rasterSlack);
+			f.x1 = std::max(f.x1, raster.x + rasterSlack);
+			f.y1 = std::max(f.y1, raster.y + rasterSlack);
+		}
+	}
+	else if(const Plane *plane = dynamic_cast<const Plane*>(object)){
+		// Hit where the direction's side of the plane matches the camera's.
+		// The unnormalized direction is linear in the raster position.
+		const float side = glm::dot(plane->pos - camera.origin, plane->normal);
+		if(side == 0.0f) return f;
+		const float s = side > 0.0f ? 1.0f : -1.0f;
+		f.kind = Footprint::HalfPlane;
+		f.b = s * glm::dot(plane->normal, camera.du);
+		f.c = s * glm::dot(plane->normal, camera.dv);
+		f.a = s * glm::dot(plane->normal, camera.corner) + std::abs(f.b) + std::abs(f.c);
+		f.near = std::abs(side) / glm::length(plane->normal) * 0.999f;
+	}
+	return f;
+}
+
+// Which objects each tile has to draw, nearest first, with their
+// footprints. Built once per frame, so a tile never looks at the objects
+// that can't show up in it.
+struct RasterBins{
+	int width = 0, height = 0, tileSize = 1, tilesX = 0;
+	std::vector<Footprint> footprints; // per object
+	std::vector<std::vector<int>> tiles;
+
+	void tileBounds(int tile, int &x0, int &y0, int &x1, int &y1) const{
+		x0 = (tile % tilesX) * tileSize;
+		y0 = (tile / tilesX) * tileSize;
+		x1 = std::min(x0 + tileSize, width);
+		y1 = std::min(y0 + tileSize, height);
+	}
+
+	void build(const Camera &camera, const std::vector<Object*> &stuff, int w, int h, int ts){
+		width = w;
+		height = h;
+		tileSize = ts;
+		tilesX = (width + tileSize - 1) / tileSize;
+		const int tilesY = (height + tileSize - 1) / tileSize;
+		footprints.resize(stuff.size());
+		tiles.assign(tilesX * tilesY, std::vector<int>());
+		for(size_t o = 0; o < stuff.size(); o++){
+			const Footprint &f = footprints[o] = footprint(camera, stuff[o]);
+			int tx0 = 0, ty0 = 0, tx1 = tilesX - 1, ty1 = tilesY - 1;
+			if(f.kind == Footprint::Nowhere) continue;
+			if(f.kind == Footprint::Rect){
+				if(f.x1 < 0.0f || f.y1 < 0.0f || f.x0 > width || f.y0 > height) continue;
+				tx0 = std::max(0, (int)(std::max(f.x0, 0.0f) / tileSize) - 1);
+				ty0 = std::max(0, (int)(std::max(f.y0, 0.0f) / tileSize) - 1);
+				tx1 = std::min(tilesX - 1, (int)(std::min(f.x1, (float)width) / tileSize));
+				ty1 = std::min(tilesY - 1, (int)(std::min(f.y1, (float)height) / tileSize));
+			}
+			for(int ty = ty0; ty <= ty1; ty++)
+				for(int tx = tx0; tx <= tx1; tx++){
+					int x0, y0, x1, y1;
+					tileBounds(tx + ty * tilesX, x0, y0, x1, y1);
+					if(f.overlaps(x0, y0, x1, y1)) tiles[tx + ty * tilesX].push_back((int)o);
+				}
+		}
+		for(std::vector<int> &objects : tiles)
+			std::sort(objects.begin(), objects.end(), [&](int a, int b){
+				return footprints[a].near < footprints[b].near || (footprints[a].near == footprints[b].near && a < b);
+			});
+	}
+};
+
+// Closest primary hit of every ray in the batch, which must come from a
+// pinhole camera and lie in the tile.
+inline void rasterizePrimary(const RasterBins &bins, int tile, const std::vector<Object*> &stuff, const RayBatch &batch, std::vector<PrimaryHit> &hits){
+	const size_t n = batch.size();
+	hits.assign(n, PrimaryHit());
+	if(!n) return;
+
+	// The samples grouped by pixel, so an object visits only the pixels
+	// under its footprint.
+	int x0, y0, x1, y1;
+	bins.tileBounds(tile, x0, y0, x1, y1);
+	const int w = x1 - x0, h = y1 - y0;
+	auto pixelOf = [&](size_t k){
+		const int i = std::min(std::max((int)batch.px[k] - x0, 0), w - 1), j = std::min(std::max((int)batch.py[k] - y0, 0), h - 1);
+		return i + j * w;
+	};
+	std::vector<int> start(w * h + 1, 0), order(n);
+	for(size_t k = 0; k < n; k++) start[pixelOf(k) + 1]++;
+	for(int p = 0; p < w * h; p++) start[p + 1] += start[p];
+	std::vector<int> next(start.begin(), start.end() - 1);
+	for(size_t k = 0; k < n; k++) order[next[pixelOf(k)]++] = (int)k;
+
+	for(int o : bins.tiles[tile]){
+		const Footprint &f = bins.footprints[o];
+		int i0 = 0, j0 = 0, i1 = w - 1, j1 = h - 1;
+		if(f.kind == Footprint::Rect){
+			i0 = std::max(0, (int)std::max(f.x0 - x0, 0.0f) - 1);
+			j0 = std::max(0, (int)std::max(f.y0 - y0, 0.0f) - 1);
+			i1 = std::min(w - 1, (int)std::min(f.x1 - x0, (float)w) + 1);
+			j1 = std::min(h - 1, (int)std::min(f.y1 - y0, (float)h) + 1);
+		}
+		for(int j = j0; j <= j1; j++)
+			for(int i = i0; i <= i1; i++)
+				for(int s = start[i + j * w]; s < start[i + j * w + 1]; s++){
+					const int k = order[s];
+					PrimaryHit &hit = hits[k];
+					float dist;
+					if(f.near > hit.dist || !f.covers(batch.px[k], batch.py[k])) continue;
+					if(stuff[o]->intersect(batch.ray(k), dist) && (dist < hit.dist || (dist == hit.dist && o < hit.object))){
+						hit.object = o;
+						hit.dist = dist;
+					}
+				}
+	}
+}
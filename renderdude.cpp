@@ -0,0 +1,620 @@
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#define STBI_MSC_SECURE_CRT
+#include "stb_image_write.h"
+
+#include "renderdude.h"
+#include "dependencies.h"
+#include "raster.h"
+#include "fastMath.h"
+#include "bvh.h"
+#include "shadowMap.h"
+#include "trace.h"
+#include "shading.h"
+#include "wavefront.h"
+#include "progress.h"
+#include "checkpoint.h"
+#include "tileCache.h"
+#include "bvhCache.h"
+#include "progressive.h"
+
+// Per node copy of the scene, built by a worker of that node so it lives in
+// that node's memory.
+struct SceneReplica{
+	std::vector<Object*> stuff;
+	std::vector<Light> lights;
+
+	SceneReplica(const std::vector<Object*> &s, const std::vector<Light> &l) : lights(l) {
+		for(auto &object : s) stuff.push_back(object->clone());
+	}
+	~SceneReplica(){
+		for(auto &object : stuff) delete object;
+	}
+
+	// Hierarchy over stuff, kept between renders that ask for the same kind,
+	// split and layout (built is set if it had to be made: loaded from the
+	// settings' cache, or built on the pool's workers, then widened if asked).
+	// Renders still using one of another kind keep it alive.
+	std::mutex bvhMutex;
+	std::shared_ptr<const BVH> bvh;
+	bool bvhLoaded = false, bvhCacheStale = false;
+	std::shared_ptr<const BVH> hierarchy(const RenderSettings &settings, ThreadPool *pool, bool &built){
+		std::lock_guard<std::mutex> lock(bvhMutex);
+		built = !bvh || bvh->build != settings.bvh || bvh->splitMethod != settings.bvhSplit || bvh->layout != settings.bvhLayout;
+		if(!built) return bvh;
+		bvhLoaded = bvhCacheStale = false;
+		std::shared_ptr<BVH> tree;
+		if(!settings.bvhCache.empty()){
+			const uint64_t geometry = geometryHash(stuff);
+			tree = loadBvh(settings.bvhCache, stuff, settings.bvh, settings.bvhSplit, geometry, bvhCacheStale);
+			bvhLoaded = tree != nullptr;
+			if(!tree){
+				tree = std::make_shared<BVH>(stuff, settings.bvh, settings.bvhSplit, pool);
+				if(settings.bvh == FullBvh && !saveBvh(settings.bvhCache, *tree, geometry))
+					std::cerr << "Couldn't write the hierarchy to " << settings.bvhCache << std::endl;
+			}
+		}
+		else tree = std::make_shared<BVH>(stuff, settings.bvh, settings.bvhSplit, pool);
+		if(settings.bvhLayout == WideBvh){
+			auto start = std::chrono::steady_clock::now();
+			tree->widen();
+			tree->buildSeconds += std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+		}
+		return bvh = tree;
+	}
+};
+
+Scene::Scene() {}
+
+Scene::~Scene(){
+	for(auto &object : objects) delete object;
+}
+
+int Scene::addMaterial(const Material &material, const std::string &name){
+	materials.push_back(material);
+	materials.back().setString(name);
+	return (int)materials.size() - 1;
+}
+
+void Scene::addSphere(glm::vec3 center, float radius, int material){
+	objects.push_back(new Sphere(center, radius, materials[material]));
+	invalidate();
+}
+
+void Scene::addPlane(glm::vec3 point, glm::vec3 normal, int material){
+	objects.push_back(new Plane(point, normal, materials[material]));
+	invalidate();
+}
+
+void Scene::addLight(const Light &light){
+	lights.push_back(light);
+	invalidate();
+}
+
+void Scene::moveObject(int object, glm::vec3 pos){
+	objects[object]->pos = pos;
+	invalidate();
+}
+
+uint32_t Scene::hash() const{
+	return sceneHash(objects, lights);
+}
+
+void Scene::invalidate(){
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	replicas.clear();
+}
+
+Renderer::Renderer(int threads, PinMode pin) :
+	pool(NumaTopology::detect(), threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()), pin) {}
+
+std::vector<SceneReplica*> Renderer::replicasOf(const Scene &scene){
+	// Built once per scene, on the node that reads them.
+	std::vector<SceneReplica*> replicas;
+	std::lock_guard<std::mutex> lock(scene.cacheMutex);
+	if((int)scene.replicas.size() != pool.nodeCount()){
+		scene.replicas.clear();
+		scene.replicas.resize(pool.nodeCount());
+		pool.broadcast([&](int worker){
+			if(pool.isNodeLeader(worker))
+				scene.replicas[pool.nodeOf(worker)].reset(new SceneReplica(scene.objects, scene.lights));
+		});
+	}
+	for(auto &replica : scene.replicas) replicas.push_back(replica.get());
+	return replicas;
+}
+
+static bool validate(const Camera &camera, const RenderSettings &settings, const RenderTarget &target, std::string &error){
+	if(settings.width <= 0 || settings.height <= 0 || settings.samples <= 0 || settings.tileSize <= 0 || !target.color)
+		error = "Nothing to render into";
+	else if(camera.width != settings.width || camera.height != settings.height)
+		error = "Camera and settings disagree on the resolution";
+	else if(settings.isProgressive() && settings.resume)
+		error = "Progressive renders can't be resumed";
+	else if(settings.isProgressive() && !settings.tileCache.empty())
+		error = "The tile cache needs a fixed sample count";
+	else if(target.retrace && (settings.isProgressive() || settings.resume || !settings.tileCache.empty()))
+		error = "Retracing needs a fixed sample count, without resume or the tile cache";
+	else if(target.dependencies && !settings.tileCache.empty())
+		error = "Per pixel dependencies and the tile cache can't be recorded together";
+	else if(settings.shadowMapResolution > 0 && (target.dependencies || target.retrace || !settings.tileCache.empty()))
+		error = "Shadow maps don't record what casts the shadows, so can't be used with dependencies or the tile cache";
+	else if(settings.bvhLayout == WideBvh && settings.bvh != FullBvh)
+		error = "Wide BVH nodes are collapsed from a complete tree, so need a full build";
+	else if(settings.shadowMapResolution < 0 || settings.shadowMapResolution > 8192)
+		error = "Shadow map resolution out of range";
+	return error.empty();
+}
+
+// One frame's worth of state: where its pixels go and what traces them.
+struct FrameJob{
+	const Camera &camera;
+	const RenderSettings &settings;
+	const RenderTarget &target;
+	FrameState frame;
+	const bool wantGuide;
+	std::vector<SceneReplica*> replicas;
+	std::vector<std::unique_ptr<WavefrontIntegrator>> integrators;
+	WavefrontStats rayCounters;
+	std::vector<CubeShadowMap> shadowMaps;
+	float shadowMapSeconds = 0.0f;
+	std::vector<std::shared_ptr<const BVH>> bvhs; // per node
+	float bvhSeconds = 0.0f;
+	bool bvhLoaded = false, bvhCacheStale = false;
+	RasterBins rasterBins;
+
+	FrameJob(Renderer &renderer, const Scene &scene, const Camera &c, const RenderSettings &s, const RenderTarget &t) :
+		camera(c), settings(s), target(t), frame(s.width, s.height, s.tileSize, t.color, t.guide), wantGuide(t.guide != nullptr) {
+		// A retrace keeps the earlier render's pixels.
+		if(!target.retrace)
+			renderer.pool.firstTouch(s.height, s.tileSize, [&](int y0, int y1){ frame.clearRows(y0, y1); });
+		replicas = renderer.replicasOf(scene);
+		for(SceneReplica *replica : replicas){
+			integrators.emplace_back(new WavefrontIntegrator(replica->stuff, replica->lights));
+			integrators.back()->reorderMask = settings.reorderMask;
+			integrators.back()->stats = &rayCounters;
+		}
+		if(settings.bvh != NoBvh){
+			// One per node, each built on the whole pool.
+			for(size_t node = 0; node < replicas.size(); node++){
+				bool built;
+				bvhs.push_back(replicas[node]->hierarchy(settings, &renderer.pool, built));
+				if(built && node == 0){
+					bvhSeconds = bvhs[node]->buildSeconds;
+					bvhLoaded = replicas[node]->bvhLoaded;
+					bvhCacheStale = replicas[node]->bvhCacheStale;
+				}
+				integrators[node]->bvh = bvhs[node].get();
+			}
+		}
+		if(settings.shadowMapResolution > 0) buildShadowMaps(renderer.pool, scene);
+		if(settings.rasterPrimary && camera.isPinhole()) rasterBins.build(camera, scene.objects, s.width, s.height, s.tileSize);
+	}
+
+	// Rows of every face of every light are handed out to the workers, and
+	// traced through the first node's hierarchy when there is one.
+	void buildShadowMaps(ThreadPool &pool, const Scene &scene){
+		auto start = std::chrono::steady_clock::now();
+		const int res = settings.shadowMapResolution, rowsPerMap = 6 * res;
+		shadowMaps.resize(scene.lights.size());
+		for(size_t i = 0; i < shadowMaps.size(); i++) shadowMaps[i].init(scene.lights[i].pos, res, settings.shadowMapBias);
+		std::atomic<int> nextRow(0);
+		const int rows = rowsPerMap * (int)shadowMaps.size();
+		pool.broadcast([&](int){
+			for(int row; (row = nextRow++) < rows;)
+				shadowMaps[row / rowsPerMap].buildRow(row % rowsPerMap, replicas[0]->stuff, bvhs.empty() ? nullptr : bvhs[0].get());
+		});
+		shadowMapSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Traces samples firstSample .. firstSample + spp of the tile's pixels
+	// (just the ones to retrace, if that's set), listed in pixels. The
+	// samples come pixel by pixel, spp in a row.
+	void traceTile(int tile, int node, int firstSample, int spp, std::vector<int> &pixels, std::vector<glm::vec3> &colors, std::vector<GBufferSample> &guides){
+		int x0, y0, x1, y1;
+		frame.tileBounds(tile, x0, y0, x1, y1);
+		pixels.clear();
+		for(int j = y0; j < y1; j++)
+			for(int i = x0; i < x1; i++)
+				if(!target.retrace || target.retrace[i + j * settings.width]) pixels.push_back(i + j * settings.width);
+		RayBatch batch;
+		std::vector<PixelSampler> samplers;
+		batch.resize(pixels.size() * spp);
+		for(int p : pixels){
+			const int i = p % settings.width, j = p / settings.width;
+			for(int sample = 0; sample < spp; sample++){
+				size_t k = samplers.size();
+				samplers.push_back(PixelSampler(settings.sampler, settings.blueNoise, settings.seed, i, j, settings.width, firstSample + sample, spp));
+				glm::vec2 offset = samplers[k].get2D(PixelDim);
+				glm::vec2 lens = camera.aperture > 0.0f ? samplers[k].get2D(LensDim) : glm::vec2(0.0f, 0.0f);
+				batch.px[k] = i + offset.x;
+				batch.py[k] = j + offset.y;
+				batch.lensU[k] = lens.x;
+				batch.lensV[k] = lens.y;
+			}
+		}
+		camera.generateRays(batch);
+
+		colors.assign(batch.size(), glm::vec3());
+		guides.assign(wantGuide ? batch.size() : 0, GBufferSample());
+		const SceneReplica &replica = *replicas[node];
+		std::vector<PrimaryHit> primary;
+		const bool raster = settings.rasterPrimary && camera.isPinhole();
+		if(raster) rasterizePrimary(rasterBins, tile, replica.stuff, batch, primary);
+		previewShadows = shadowMaps.empty() ? nullptr : &shadowMaps;
+		shadingMath = settings.math;
+		sceneBvh = bvhs.empty() ? nullptr : bvhs[node].get();
+		// Per pixel dependencies are recorded along cast_ray's paths.
+		if(settings.wavefront && !target.dependencies){
+			integrators[node]->trace(batch, samplers, colors, wantGuide ? &guides : nullptr, raster ? &primary : nullptr);
+			previewShadows = nullptr;
+			sceneBvh = nullptr;
+			return;
+		}
+		TileDependencies pixelDependencies;
+		for(size_t k = 0; k < batch.size(); k++){
+			if(target.dependencies && k % spp == 0){
+				pixelDependencies.reset(0, 0);
+				recordDependencies = &pixelDependencies;
+			}
+			if(target.dependencies) pixelDependencies.group = (int)(k % spp) * dependencyGroups / spp;
+			colors[k] = cast_ray(batch.ray(k), replica.stuff, replica.lights, samplers[k], 0, wantGuide ? &guides[k] : nullptr, raster ? &primary[k] : nullptr);
+			if(target.dependencies && k % spp == (size_t)spp - 1){
+				recordDependencies = nullptr;
+				pixelDependencies.store(target.dependencies[pixels[k / spp]]);
+			}
+		}
+		previewShadows = nullptr;
+		sceneBvh = nullptr;
+	}
+
+	// Averages the traced pixels' samples into the frame, for fixed sample renders.
+	void resolveTile(int tile, int spp, const std::vector<int> &pixels, const std::vector<glm::vec3> &colors, const std::vector<GBufferSample> &guides){
+		const float samples = spp;
+		for(size_t n = 0; n < pixels.size(); n++){
+			int currentPos = pixels[n];
+			size_t first = n * spp;
+			glm::vec3 finalResult;
+			GBufferSample pixelGuide;
+			for(int sample = 0; sample < spp; sample++){
+				finalResult += colors[first + sample];
+				if(wantGuide)
+					pixelGuide.accumulate(guides[first + sample], 1.0f / samples);
+			}
+			finalResult /= samples;
+			frame.color[currentPos] = finalResult;
+			if(wantGuide)
+				frame.guide[currentPos] = pixelGuide;
+		}
+		frame.markDone(tile);
+	}
+
+	void frameStats(RenderStats &stats) const{
+		stats.shadowMapSeconds = shadowMapSeconds;
+		for(const CubeShadowMap &map : shadowMaps) stats.shadowMapBytes += map.bytes();
+		stats.bvhSeconds = bvhSeconds;
+		stats.bvhLoaded = bvhLoaded;
+		stats.bvhCacheStale = bvhCacheStale;
+		if(!bvhs.empty()){
+			stats.bvhNodes = bvhs[0]->nodeCount;
+			stats.bvhPrimitives = bvhs[0]->primitiveCount;
+			stats.bvhSahCost = bvhs[0]->sahCost();
+			stats.bvhNodeBytes = bvhs[0]->nodeBytes();
+			bvhs[0]->census(stats.bvhUnsplitNodes, stats.bvhUnsplitPrimitives);
+		}
+		if(!settings.wavefront) return;
+		for(size_t d = 0; d <= maxTraceDepth; d++){
+			BounceStats bounce;
+			bounce.rays = rayCounters.rays[d];
+			bounce.shadowRays = rayCounters.shadowRays[d];
+			bounce.seconds = rayCounters.nanoseconds[d] * 1e-9;
+			stats.bounces.push_back(bounce);
+		}
+	}
+};
+
+bool Renderer::render(const Scene &scene, const Camera &camera, const RenderSettings &settings, const RenderTarget &target,
+	RenderStats &stats, const CancellationToken *cancel){
+	const auto callStart = std::chrono::steady_clock::now();
+	stats = RenderStats();
+	if(!validate(camera, settings, target, stats.error)) return false;
+	const int width = settings.width, height = settings.height;
+	const bool progressive = settings.isProgressive();
+	const bool budgeted = settings.timeBudget > 0.0f || settings.rayBudget > 0;
+	const bool wantGuide = target.guide != nullptr;
+
+	FrameJob job(*this, scene, camera, settings, target);
+	FrameState &frame = job.frame;
+	stats.tileCount = frame.tileCount;
+
+	CheckpointHeader checkpointHeader;
+	checkpointHeader.width = width;
+	checkpointHeader.height = height;
+	checkpointHeader.tileSize = settings.tileSize;
+	checkpointHeader.samples = settings.samples;
+	checkpointHeader.seed = settings.seed;
+	checkpointHeader.sampler = settings.sampler;
+	checkpointHeader.blueNoise = settings.blueNoise;
+	checkpointHeader.hasGuide = wantGuide;
+	checkpointHeader.scene = scene.hash();
+	checkpointHeader.camera = cameraHash(camera);
+	checkpointHeader.shadowMapResolution = settings.shadowMapResolution;
+	checkpointHeader.shadowMapBias = settings.shadowMapResolution > 0 ? settings.shadowMapBias : 0.0f;
+	checkpointHeader.math = settings.math;
+	const bool checkpoints = !progressive && !settings.checkpointFile.empty() && !target.retrace;
+	if(checkpoints && settings.resume)
+		stats.restoredTiles = frame.load(settings.checkpointFile.c_str(), checkpointHeader);
+
+	// Tiles still good from an earlier render of this view count as done.
+	std::unique_ptr<TileCache> tileCache;
+	if(!settings.tileCache.empty()){
+		CheckpointHeader view = checkpointHeader;
+		view.scene = 0;
+		view.hasGuide = 0;
+		tileCache.reset(new TileCache(settings.tileCache, hashBytes(14695981039346656037ull, &view, sizeof(view)), scene.objects, scene.lights));
+		if(!tileCache->ok){
+			std::cerr << "Can't use " << settings.tileCache << " as a tile cache" << std::endl;
+			tileCache.reset();
+		}
+		for(int tile = 0; tileCache && tile < frame.tileCount; tile++)
+			if(!frame.isDone(tile) && tileCache->load(tile, frame)){
+				frame.markDone(tile);
+				stats.cachedTiles++;
+			}
+	}
+	std::atomic<int> cacheWriteFailures(0);
+	std::atomic<bool> firstTileDone(false);
+
+	std::vector<std::vector<int>> nodeTiles(pool.nodeCount());
+	for(int tile = 0; tile < frame.tileCount; tile++)
+		nodeTiles[pool.tileNode(tile / frame.tilesX, frame.tilesY)].push_back(tile);
+
+	uint64_t doneTiles = 0, donePixels = 0;
+	for(int tile = 0; tile < frame.tileCount; tile++){
+		if(!frame.isDone(tile)) continue;
+		int x0, y0, x1, y1;
+		frame.tileBounds(tile, x0, y0, x1, y1);
+		doneTiles++;
+		donePixels += (uint64_t)(x1 - x0) * (y1 - y0);
+	}
+
+	auto renderStart = std::chrono::steady_clock::now();
+	ProgressCounters progress(pool.size());
+	ProgressReporter reporter(progress, frame.tileCount, (uint64_t)width * height, doneTiles, donePixels,
+		settings.progressInterval, settings.progressJson);
+	reporter.timeBudget = settings.timeBudget;
+	reporter.rayBudget = settings.rayBudget;
+
+	// Stops on the caller's token or when the budget runs out.
+	CancellationToken stop;
+	std::unique_ptr<AccumulationBuffer> accumulation;
+	std::unique_ptr<SnapshotWriter> snapshotWriter;
+	if(progressive) accumulation.reset(new AccumulationBuffer(width, height, frame.tileCount, wantGuide));
+	if(settings.snapshotPasses > 0 || settings.snapshotInterval > 0.0f)
+		snapshotWriter.reset(new SnapshotWriter(settings.snapshotFile, width, height));
+	int pass = 0;
+
+	Checkpointer checkpointer(frame, checkpointHeader, settings.checkpointFile, checkpoints ? settings.checkpointInterval : 0.0f);
+	auto renderTile = [&](int tile, int worker) -> size_t {
+		if(cancel && cancel->cancelled()) stop.cancel();
+		if(frame.isDone(tile) || stop.cancelled()) return 0;
+		const uint64_t raysBefore = raysTraced;
+		const int spp = progressive ? 1 : settings.samples;
+
+		std::vector<int> pixels;
+		std::vector<glm::vec3> sampleColors;
+		std::vector<GBufferSample> sampleGuides;
+		TileDependencies dependencies;
+		if(tileCache){
+			dependencies.reset(scene.objects.size(), scene.lights.size());
+			recordDependencies = &dependencies;
+		}
+		job.traceTile(tile, pool.nodeOf(worker), pass * spp, spp, pixels, sampleColors, sampleGuides);
+		recordDependencies = nullptr;
+		if(progressive){
+			for(size_t k = 0; k < pixels.size(); k++)
+				accumulation->add(pixels[k], sampleColors[k], wantGuide ? &sampleGuides[k] : nullptr);
+			accumulation->tilePasses[tile]++;
+		}
+		else
+			job.resolveTile(tile, spp, pixels, sampleColors, sampleGuides);
+		if(tileCache && !tileCache->store(tile, dependencies, frame)) cacheWriteFailures++;
+		if(!firstTileDone.exchange(true))
+			stats.firstTileSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - callStart).count();
+		progress.add(worker, 1, pixels.size(), raysTraced - raysBefore);
+
+		if(settings.timeBudget > 0.0f && reporter.elapsed() >= settings.timeBudget) stop.cancel();
+		if(settings.rayBudget){
+			uint64_t tiles, pixels, rays;
+			progress.sum(tiles, pixels, rays);
+			if(rays >= settings.rayBudget) stop.cancel();
+		}
+		return pixels.size();
+	};
+	if(progressive){
+		// Snapshots are taken between passes, while no tile is being written.
+		std::vector<RGB> snapshot;
+		float lastSnapshot = 0.0f;
+		for(pass = 0; !stop.cancelled() && !(cancel && cancel->cancelled()) && (budgeted || pass < settings.samples); pass++){
+			pool.runTiles(nodeTiles, renderTile, &stop);
+			bool due = (settings.snapshotPasses > 0 && (pass + 1) % settings.snapshotPasses == 0) ||
+				(settings.snapshotInterval > 0.0f && reporter.elapsed() - lastSnapshot >= settings.snapshotInterval);
+			if(snapshotWriter && due){
+				accumulation->resolve(snapshot, frame);
+				snapshotWriter->submit(snapshot);
+				lastSnapshot = reporter.elapsed();
+			}
+		}
+	}
+	else
+		pool.runTiles(nodeTiles, renderTile, &stop);
+	checkpointer.stop();
+	reporter.stop();
+	if(cacheWriteFailures)
+		std::cerr << "Couldn't write " << cacheWriteFailures << " tiles to " << settings.tileCache << std::endl;
+
+	if(progressive){
+		accumulation->resolve(frame, target.sampleCount);
+		const std::vector<int> &passes = accumulation->tilePasses;
+		stats.passes = pass;
+		stats.minSamples = *std::min_element(passes.begin(), passes.end());
+		stats.maxSamples = *std::max_element(passes.begin(), passes.end());
+		stats.interrupted = cancel && cancel->cancelled();
+	}
+	else{
+		stats.passes = 1;
+		stats.interrupted = false;
+		for(int tile = 0; tile < frame.tileCount; tile++)
+			if(!frame.isDone(tile)) stats.interrupted = true;
+		stats.minSamples = stats.interrupted ? 0 : settings.samples;
+		stats.maxSamples = settings.samples;
+		if(target.sampleCount) frame.fillSampleCount(target.sampleCount, settings.samples);
+		// Keep a checkpoint so the caller can resume the rest.
+		if(stats.interrupted && checkpoints && !frame.save(settings.checkpointFile.c_str(), checkpointHeader))
+			std::cerr << "Couldn't write " << settings.checkpointFile << std::endl;
+	}
+	if(snapshotWriter){
+		snapshotWriter->stop();
+		stats.snapshots = snapshotWriter->written;
+	}
+
+	std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - renderStart;
+	stats.seconds = elapsed.count();
+	uint64_t tiles, pixels;
+	progress.sum(tiles, pixels, stats.rays);
+	job.frameStats(stats);
+	return true;
+}
+
+bool Renderer::renderBatch(const std::vector<BatchJob> &batch, std::vector<RenderStats> &stats, const CancellationToken *cancel){
+	stats.assign(batch.size(), RenderStats());
+	bool ok = true;
+	for(size_t b = 0; b < batch.size(); b++){
+		const BatchJob &item = batch[b];
+		if(!validate(item.camera, item.settings, item.target, stats[b].error)) ok = false;
+		else if(item.settings.isProgressive() || item.settings.resume) stats[b].error = "Batch jobs render a fixed number of samples";
+		else if(!item.settings.tileCache.empty()) stats[b].error = "Batch jobs don't use the tile cache";
+		else if(!item.scene) stats[b].error = "No scene";
+		if(!stats[b].error.empty()) ok = false;
+	}
+	if(!ok) return false;
+
+	// Views of one scene share its replicas, which are built on first use.
+	std::vector<std::unique_ptr<FrameJob>> jobs;
+	std::vector<int> firstTile;
+	int tileCount = 0;
+	for(const BatchJob &item : batch){
+		jobs.emplace_back(new FrameJob(*this, *item.scene, item.camera, item.settings, item.target));
+		firstTile.push_back(tileCount);
+		tileCount += jobs.back()->frame.tileCount;
+	}
+
+	// Every job's tiles go into one run, each on the node owning its rows, so
+	// workers move on to the next image instead of waiting for the slowest
+	// tile of the current one.
+	std::vector<std::vector<int>> nodeTiles(pool.nodeCount());
+	for(size_t b = 0; b < jobs.size(); b++){
+		const FrameState &frame = jobs[b]->frame;
+		for(int tile = 0; tile < frame.tileCount; tile++)
+			nodeTiles[pool.tileNode(tile / frame.tilesX, frame.tilesY)].push_back(firstTile[b] + tile);
+	}
+
+	auto batchStart = std::chrono::steady_clock::now();
+	std::unique_ptr<std::atomic<uint64_t>[]> rays(new std::atomic<uint64_t>[jobs.size()]);
+	std::unique_ptr<std::atomic<int>[]> tilesLeft(new std::atomic<int>[jobs.size()]);
+	for(size_t b = 0; b < jobs.size(); b++){
+		rays[b] = 0;
+		tilesLeft[b] = jobs[b]->frame.tileCount;
+	}
+	pool.runTiles(nodeTiles, [&](int globalTile, int worker) -> size_t {
+		const int b = int(std::upper_bound(firstTile.begin(), firstTile.end(), globalTile) - firstTile.begin()) - 1;
+		const int tile = globalTile - firstTile[b];
+		FrameJob &job = *jobs[b];
+		const uint64_t raysBefore = raysTraced;
+		std::vector<int> pixels;
+		std::vector<glm::vec3> sampleColors;
+		std::vector<GBufferSample> sampleGuides;
+		job.traceTile(tile, pool.nodeOf(worker), 0, job.settings.samples, pixels, sampleColors, sampleGuides);
+		job.resolveTile(tile, job.settings.samples, pixels, sampleColors, sampleGuides);
+		rays[b] += raysTraced - raysBefore;
+		// Seconds are from the start of the batch to the job's last tile.
+		if(--tilesLeft[b] == 0)
+			stats[b].seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - batchStart).count();
+		return pixels.size();
+	}, cancel);
+
+	for(size_t b = 0; b < jobs.size(); b++){
+		const BatchJob &item = batch[b];
+		RenderStats &s = stats[b];
+		s.tileCount = jobs[b]->frame.tileCount;
+		s.passes = 1;
+		s.interrupted = tilesLeft[b] > 0;
+		s.minSamples = s.interrupted ? 0 : item.settings.samples;
+		s.maxSamples = item.settings.samples;
+		s.rays = rays[b];
+		if(item.target.sampleCount) jobs[b]->frame.fillSampleCount(item.target.sampleCount, item.settings.samples);
+		jobs[b]->frameStats(s);
+	}
+	return true;
+}
+
+// Whether the object comes near a segment of the pixel's paths. A segment
+// runs between two vertex boxes, so stays within the larger box's half
+// diagonal of the line between their centers; reflection and shadow rays
+// start a little off their hit, and shadow rays end on the light's disc.
+static bool reachesPaths(const PixelDependency &d, const Object &now, const std::vector<Light> &lights){
+	const glm::vec3 step = (d.hi - d.lo) / 255.0f;
+	const float margin = 2e-3f + 1e-5f * glm::length(d.hi - d.lo);
+	for(int g = 0; g < dependencyGroups; g++){
+		glm::vec3 center[dependencyVertices];
+		float reach[dependencyVertices];
+		for(int v = 0; v < d.vertices[g]; v++){
+			const uint8_t *q = d.path[g][v];
+			glm::vec3 lo = d.lo + glm::vec3(q[0], q[1], q[2]) * step, hi = d.lo + glm::vec3(q[3], q[4], q[5]) * step;
+			center[v] = (lo + hi) * 0.5f;
+			reach[v] = glm::length(hi - lo) * 0.5f + margin;
+			if(v == 0) continue;
+			if(now.nearSegment(center[v - 1], center[v], std::max(reach[v - 1], reach[v]))) return true;
+			for(const Light &light : lights)
+				if(now.nearSegment(center[v], light.pos, std::max(reach[v], light.radius + margin))) return true;
+		}
+	}
+	return false;
+}
+
+size_t markAffected(const PixelDependency *dependencies, size_t pixelCount, int object, const Object &now, const std::vector<Light> &lights,
+	uint8_t *retrace){
+	const uint64_t bit = 1ull << (object & 63);
+	size_t marked = 0;
+	for(size_t p = 0; p < pixelCount; p++){
+		const PixelDependency &d = dependencies[p];
+		if((d.objects & bit) || d.unbounded || (now.overlapsBox(d.lo, d.hi) && reachesPaths(d, now, lights))){
+			retrace[p] = 1;
+			marked++;
+		}
+	}
+	return marked;
+}
+
+bool writePNG(const std::string &filename, int width, int height, const glm::vec3 *color){
+	std::vector<RGB> image((size_t)width * height);
+	for(size_t p = 0; p < image.size(); p++){
+		glm::vec3 c = glm::clamp(color[p], 0.0f, 1.0f) * 255.0f;
+		image[p] = RGB(std::round(c.x), std::round(c.y), std::round(c.z));
+	}
+	return stbi_write_png(filename.c_str(), width, height, 3, image.data(), 0) != 0;
+}
+
+ImageError compareImages(const glm::vec3 *image, const glm::vec3 *reference, size_t pixelCount){
+	ImageError error;
+	double squares = 0.0;
+	for(size_t p = 0; p < pixelCount; p++){
+		glm::vec3 d = glm::abs(glm::clamp(image[p], 0.0f, 1.0f) - glm::clamp(reference[p], 0.0f, 1.0f));
+		squares += (double)d.x * d.x + (double)d.y * d.y + (double)d.z * d.z;
+		float worst = std::max(d.x, std::max(d.y, d.z));
+		error.maxError = std::max(error.maxError, (double)worst);
+		if(worst > 1.0f / 255.0f) error.badPixels++;
+	}
+	error.rmse = pixelCount ? std::sqrt(squares / (3.0 * pixelCount)) : 0.0;
+	error.psnr = error.rmse > 0.0 ? 20.0 * std::log10(1.0 / error.rmse) : std::numeric_limits<double>::infinity();
+	return error;
+}
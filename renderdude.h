@@ -0,0 +1,267 @@
+// Renderdude as a library. Build a Scene, point a Camera at it and hand both
+// to a Renderer together with buffers of your own; the pixels are written
+// straight into them. A Renderer owns the worker pool and a Scene keeps its
+// per node copies between renders, so one of each can serve many frames.
+//
+// Several threads may call Renderer::render at once, on the same or on
+// different scenes, but the renders are serialized: each pass over the tiles
+// gets the whole pool and the others wait for it. To render many images side
+// by side, give them to renderBatch, which interleaves their tiles. A scene
+// must not be changed while it is being rendered.
+
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <filesystem>
+
+#include <glm/glm.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/transform.hpp>
+#include <glm/gtx/euler_angles.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "criticalMath.h"
+#include "sampling.h"
+#include "exrWrite.h"
+#include "aov.h"
+#include "camera.h"
+#include "threadPool.h"
+
+const size_t maxTraceDepth = 8; // cast_ray gives up past this depth
+
+// How shading does its math: ReferenceMath is exact libm, FastMath uses the
+// polynomial approximations in fastMath.h (pow, atan, asin, rsqrt).
+enum MathTier{
+	ReferenceMath, FastMath
+};
+
+// How the scene's bounding volume hierarchy is built, if at all.
+enum BvhBuild{
+	NoBvh,   // every ray tests every object
+	FullBvh, // all of it before the first ray
+	LazyBvh  // the top levels first, the rest as rays reach it
+};
+
+// Where its nodes are split: quick builds against quick traversal.
+enum BvhSplit{
+	MedianSplit, // halves along the longest axis
+	SahSplit,    // binned surface area heuristic
+	MortonSplit  // by Morton code (an LBVH), quickest to build
+};
+
+// How the tree is laid out for traversal.
+enum BvhLayout{
+	BinaryBvh, // two children per node, float boxes
+	WideBvh    // four per node, boxes on an 8 bit grid over the parent's, complete trees only
+};
+
+struct RenderSettings{
+	int width = 1280, height = 720;
+	int samples = 4;
+	int tileSize = 32;
+	uint32_t seed = 0x5eed;
+	SamplerType sampler = SobolSampler;
+	bool blueNoise = false;
+
+	bool wavefront = false;
+	uint32_t reorderMask = 0; // bit d: reorder bounce d, wavefront only
+	bool rasterPrimary = false; // find primary hits by rasterizing, pinhole cameras only (others trace them)
+
+	// Preview shadows: a cube shadow map per light, shadowMapResolution texels
+	// a side, looked up instead of tracing shadow rays (0 traces them). Area
+	// lights shadow like point lights. Lookups are pushed off the surface by
+	// a texel or so; the bias, in scene units, is taken off the depth on top.
+	int shadowMapResolution = 0;
+	float shadowMapBias = 0.05f;
+
+	MathTier math = ReferenceMath;
+
+	// Kept with the scene's per node copies between renders, so a lazy build
+	// goes on where the last render left it.
+	BvhBuild bvh = NoBvh;
+	BvhSplit bvhSplit = SahSplit;
+	BvhLayout bvhLayout = BinaryBvh;
+	std::string bvhCache; // directory of complete hierarchies by geometry, if any (see bvhCache.h)
+
+	// Progressive renders do one sample per pixel per pass over the whole
+	// frame, for samples passes or until a budget runs out. Setting a budget
+	// or snapshots turns it on.
+	bool progressive = false;
+	float timeBudget = 0.0f;
+	uint64_t rayBudget = 0;
+	std::string snapshotFile = "snapshot.png";
+	int snapshotPasses = 0;
+	float snapshotInterval = 0.0f;
+
+	// Fixed sample renders only. An empty name turns checkpoints off, an
+	// interval of 0 leaves only the one written when the render is cancelled.
+	std::string checkpointFile;
+	float checkpointInterval = 60.0f;
+	bool resume = false;
+
+	// Directory of tiles kept from earlier renders, fixed sample renders only.
+	// Tiles whose dependencies haven't changed are read back instead of traced.
+	std::string tileCache;
+
+	// Progress line on stderr (0 is off) and NDJSON progress ("-" is stdout).
+	float progressInterval = 0.0f;
+	std::string progressJson;
+
+	bool isProgressive() const{
+		return progressive || timeBudget > 0.0f || rayBudget > 0 || snapshotPasses > 0 || snapshotInterval > 0.0f;
+	}
+};
+
+const int dependencyGroups = 4;                   // a pixel's samples are split in this many paths
+const int dependencyVertices = maxTraceDepth + 2; // the ray's origin, then every hit
+
+// What one pixel's paths hit (primary, reflection and shadow rays): object i
+// sets bit i % 64, so past 64 objects it is a superset like a Bloom filter.
+// lo/hi bound every ray segment, unbounded means some ray hit nothing.
+// path holds, for each group of samples, a box around each of its vertices by
+// depth, as 8 bit steps across lo..hi (lo x, y, z then hi x, y, z); the path
+// runs through them, with a shadow ray from each hit to every light.
+struct PixelDependency{
+	uint64_t objects = 0;
+	glm::vec3 lo, hi;
+	bool unbounded = false;
+	uint8_t vertices[dependencyGroups] = {}; // path length of each group
+	uint8_t path[dependencyGroups][dependencyVertices][6];
+};
+
+// Caller owned output, width * height entries each, row major from the top
+// left. Nothing needs to be initialized. guide, sampleCount and dependencies
+// are optional; asking for dependencies traces with cast_ray.
+//
+// With retrace set the buffers must hold an earlier render of the same view,
+// and only pixels with retrace[p] != 0 are traced again (see markAffected).
+// Fixed sample renders only.
+struct RenderTarget{
+	glm::vec3 *color = nullptr;
+	GBufferSample *guide = nullptr;
+	int *sampleCount = nullptr;
+	PixelDependency *dependencies = nullptr;
+	const uint8_t *retrace = nullptr;
+};
+
+struct BounceStats{
+	uint64_t rays = 0, shadowRays = 0;
+	double seconds = 0.0; // spent intersecting
+};
+
+struct RenderStats{
+	bool interrupted = false; // cancelled before all samples were in
+	int restoredTiles = -1;   // with resume: tiles loaded from the checkpoint, -1 if none matched
+	int cachedTiles = 0;      // taken from the tile cache
+	int tileCount = 0;
+	int passes = 0, minSamples = 0, maxSamples = 0;
+	int snapshots = 0;
+	uint64_t rays = 0;
+	float seconds = 0.0f;
+	std::vector<BounceStats> bounces; // wavefront only
+	float shadowMapSeconds = 0.0f;    // building them, not part of seconds
+	size_t shadowMapBytes = 0;
+	float firstTileSeconds = 0.0f;    // from the call to the first finished tile, setup included
+	float bvhSeconds = 0.0f;          // building the hierarchy up front, 0 if it was kept from before
+	int bvhNodes = 0, bvhUnsplitNodes = 0; // after the render
+	size_t bvhPrimitives = 0, bvhUnsplitPrimitives = 0; // primitives no ray reached below the eager levels
+	bool bvhLoaded = false, bvhCacheStale = false; // from the cache; a cache file there was rebuilt
+	size_t bvhNodeBytes = 0;          // in the layout traversed
+	double bvhSahCost = 0.0;          // expected node visits plus primitive tests per ray through the scene's bounds
+	std::string error;
+};
+
+struct SceneReplica;
+
+struct Scene{
+	std::vector<Material> materials;
+	std::vector<Object*> objects;
+	std::vector<Light> lights;
+
+	Scene();
+	~Scene();
+	Scene(const Scene&) = delete;
+	Scene &operator=(const Scene&) = delete;
+
+	// Returns the material's index, for addSphere/addPlane.
+	int addMaterial(const Material &material, const std::string &name);
+	void addSphere(glm::vec3 center, float radius, int material);
+	void addPlane(glm::vec3 point, glm::vec3 normal, int material);
+	void addLight(const Light &light);
+	void moveObject(int object, glm::vec3 pos);
+	uint32_t hash() const;
+
+	// Per node copies, made on first render and kept until the scene changes.
+	mutable std::mutex cacheMutex;
+	mutable std::vector<std::unique_ptr<SceneReplica>> replicas;
+	void invalidate();
+};
+
+// One image of a batch: a view of a scene and where its pixels go.
+struct BatchJob{
+	const Scene *scene = nullptr;
+	Camera camera;
+	RenderSettings settings; // fixed sample count only: no budgets, progressive passes or checkpoints
+	RenderTarget target;
+};
+
+struct Renderer{
+	ThreadPool pool;
+
+	// threads <= 0 means one per hardware thread.
+	Renderer(int threads = 0, PinMode pin = PinNode);
+
+	// Renders into target. Returns false (with stats.error set) if the
+	// settings don't make sense; cancel may be set from any thread, or a
+	// signal handler, to stop early with whatever is done.
+	bool render(const Scene &scene, const Camera &camera, const RenderSettings &settings, const RenderTarget &target,
+		RenderStats &stats, const CancellationToken *cancel = nullptr);
+
+	// Renders all jobs in one go, tiles of every image sharing the pool, so
+	// many small images keep all threads busy. stats gets one entry per job;
+	// returns false if any job's settings don't make sense (nothing is
+	// rendered then).
+	bool renderBatch(const std::vector<BatchJob> &batch, std::vector<RenderStats> &stats, const CancellationToken *cancel = nullptr);
+
+	// The scene's per node copies, made if they aren't there yet.
+	std::vector<SceneReplica*> replicasOf(const Scene &scene);
+};
+
+// Sets retrace[p] for every pixel that changing object `object` into `now`
+// could affect: those whose paths hit it before (its old footprint, as far
+// as the bit set tells) and those whose path segments, reflections or shadow
+// rays towards lights (the scene's, unchanged), it now reaches (its new one).
+// Returns how many pixels were marked; retrace isn't cleared first.
+size_t markAffected(const PixelDependency *dependencies, size_t pixelCount, int object, const Object &now, const std::vector<Light> &lights,
+	uint8_t *retrace);
+
+// 8-bit PNG of a width * height color buffer, clamped to [0, 1].
+bool writePNG(const std::string &filename, int width, int height, const glm::vec3 *color);
+
+// How far an image is from a reference render of the same view, on colors
+// clamped to [0, 1] as they're written out. badPixels have a channel off by
+// more than one 8 bit step.
+struct ImageError{
+	double rmse = 0.0, maxError = 0.0, psnr = 0.0; // psnr in dB, infinite if identical
+	size_t badPixels = 0;
+};
+
+ImageError compareImages(const glm::vec3 *image, const glm::vec3 *reference, size_t pixelCount);
@@ -0,0 +1,206 @@
+// Counter-based random numbers. Every value is a pure function of
+// (seed, pixel, sample, bounce, counter), so the image does not depend on
+// thread count or on the order tiles/pixels get picked up.
+
+inline uint32_t pcgHash(uint32_t v){
+	uint32_t state = v * 747796405u + 2891336453u;
+	uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+struct SampleRNG{
+	uint32_t key;
+	uint32_t counter = 0;
+
+	SampleRNG(uint32_t seed, uint32_t pixel, uint32_t sample, uint32_t bounce = 0) :
+		key(pcgHash(pcgHash(pcgHash(seed ^ pcgHash(pixel)) ^ sample) ^ bounce)) {}
+
+	uint32_t nextUint(){
+		return pcgHash(key ^ pcgHash(counter++ + 0x9e3779b9u));
+	}
+	// 24 random bits so the result is exactly representable and always < 1.
+	float nextFloat(){
+		return (nextUint() >> 8) * (1.0f / 16777216.0f);
+	}
+	glm::vec2 next2D(){
+		float a = nextFloat();
+		return glm::vec2(a, nextFloat());
+	}
+};
+
+// Jittered position inside the pixel for a given sample. Samples fall into a
+// square grid of strata (2x2 for 4 samples) and get jittered inside their stratum.
+inline glm::vec2 pixelSample(uint32_t seed, uint32_t pixel, int sample, int sampleCount){
+	int strata = std::max(1, (int)std::sqrt((float)sampleCount));
+	int cell = sample % (strata * strata);
+	SampleRNG rng(seed, pixel, sample);
+	glm::vec2 jitter = rng.next2D();
+	return glm::vec2(((cell % strata) + jitter.x) / strata, ((cell / strata) + jitter.y) / strata);
+}
+
+enum SamplerType{
+	RandomSampler, StratifiedSampler, HaltonSampler, SobolSampler
+};
+
+// 2D dimension pairs handed out by the sampler. Light pairs follow per bounce
+// and per light, see lightDimension().
+enum SampleDimension{
+	PixelDim = 0, LensDim = 1, LightDim = 2
+};
+
+inline uint32_t lightDimension(size_t depth, size_t light, size_t lightCount){
+	return LightDim + (uint32_t)(depth * lightCount + light);
+}
+
+inline uint32_t reverseBits(uint32_t x){
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+// Second Sobol dimension (the first one is just reverseBits).
+inline uint32_t sobol2(uint32_t i){
+	uint32_t r = 0;
+	for(uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1)
+		if(i & 1) r ^= v;
+	return r;
+}
+
+// Hash based Owen scrambling (Laine-Karras permutation on reversed bits).
+inline uint32_t owenScramble(uint32_t x, uint32_t seed){
+	x = reverseBits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverseBits(x);
+}
+
+inline float uintToFloat(uint32_t x){
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+const uint32_t haltonPrimes[] = {
+	2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+	59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+};
+const uint32_t haltonPairs = sizeof(haltonPrimes) / sizeof(haltonPrimes[0]) / 2;
+
+inline float radicalInverse(uint32_t base, uint32_t index){
+	float invBase = 1.0f / base, invBaseN = 1.0f, result = 0.0f;
+	while(index){
+		uint32_t next = index / base;
+		result += (index - next * base) * (invBaseN *= invBase);
+		index = next;
+	}
+	return std::min(result, 0.99999994f);
+}
+
+// Tileable 64x64 blue noise mask, built once by repeatedly dropping the next
+// rank into the largest void (lowest gaussian energy) of the ones already placed.
+struct BlueNoiseMask{
+	static const int size = 64;
+	float value[size * size];
+
+	BlueNoiseMask(){
+		const int n = size * size, radius = 6;
+		const float sigma2 = 2.0f * 1.9f * 1.9f;
+		std::vector<float> energy(n, 0.0f);
+		std::vector<bool> taken(n, false);
+		float kernel[2 * radius + 1][2 * radius + 1];
+		for(int dy = -radius; dy <= radius; dy++)
+			for(int dx = -radius; dx <= radius; dx++)
+				kernel[dy + radius][dx + radius] = std::exp(-(dx * dx + dy * dy) / sigma2);
+
+		for(int rank = 0; rank < n; rank++){
+			int best = -1;
+			for(int p = 0; p < n; p++)
+				if(!taken[p] && (best < 0 || energy[p] < energy[best])) best = p;
+			taken[best] = true;
+			value[best] = (rank + 0.5f) / n;
+			int bx = best % size, by = best / size;
+			for(int dy = -radius; dy <= radius; dy++)
+				for(int dx = -radius; dx <= radius; dx++)
+					energy[((bx + dx) & (size - 1)) + ((by + dy) & (size - 1)) * size] += kernel[dy + radius][dx + radius];
+		}
+	}
+
+	// Each dimension reads the mask at its own toroidal offset.
+	float lookup(int x, int y, uint32_t dim) const{
+		uint32_t h = pcgHash(dim + 0x3c6ef372u);
+		return value[((x + h) & (size - 1)) + ((y + (h >> 8)) & (size - 1)) * size];
+	}
+};
+
+inline const BlueNoiseMask &blueNoise(){
+	static BlueNoiseMask mask;
+	return mask;
+}
+
+// Hands out 2D samples for one (pixel, sample) pair. With blueNoise on, all
+// pixels share one sequence which is Cranley-Patterson rotated per pixel by
+// the blue noise mask, so the leftover error is pushed to high frequencies.
+// Otherwise every pixel gets its own hashed scramble.
+struct PixelSampler{
+	SamplerType type;
+	bool useBlueNoise;
+	uint32_t seed, pixel, sample;
+	int x, y, sampleCount;
+
+	PixelSampler(SamplerType t, bool bn, uint32_t s, int px, int py, int w, int index, int count) :
+		type(t), useBlueNoise(bn), seed(s), pixel(px + py * w), sample(index), x(px), y(py), sampleCount(count) {}
+
+	glm::vec2 get2D(uint32_t dim){
+		glm::vec2 u;
+		uint32_t scrambleKey = useBlueNoise ? pcgHash(seed) : pcgHash(seed ^ pcgHash(pixel));
+		switch(type){
+			case StratifiedSampler:
+				if(dim == PixelDim)
+					return pixelSample(seed, pixel, sample, sampleCount);
+				return SampleRNG(seed, pixel, sample, dim).next2D();
+			case HaltonSampler:
+				if(dim >= haltonPairs)
+					return SampleRNG(seed, pixel, sample, dim).next2D();
+				u = glm::vec2(radicalInverse(haltonPrimes[2 * dim], sample), radicalInverse(haltonPrimes[2 * dim + 1], sample));
+				if(!useBlueNoise){
+					SampleRNG shift(seed, pixel, 0xffffffffu, dim);
+					return rotate(u, shift.next2D());
+				}
+				break;
+			case SobolSampler:{
+				// Padded 2D Owen-scrambled Sobol, index shuffled per dimension pair.
+				uint32_t key = pcgHash(scrambleKey ^ pcgHash(dim));
+				uint32_t index = owenScramble(sample, key);
+				u = glm::vec2(uintToFloat(owenScramble(reverseBits(index), pcgHash(key ^ 1u))),
+							  uintToFloat(owenScramble(sobol2(index), pcgHash(key ^ 2u))));
+				break;
+			}
+			default:
+				return SampleRNG(seed, pixel, sample, dim).next2D();
+		}
+		if(useBlueNoise){
+			const BlueNoiseMask &mask = blueNoise();
+			u = rotate(u, glm::vec2(mask.lookup(x, y, 2 * dim), mask.lookup(x, y, 2 * dim + 1)));
+		}
+		return u;
+	}
+
+	static glm::vec2 rotate(glm::vec2 u, glm::vec2 shift){
+		u = u + shift;
+		u.x = u.x >= 1.0f ? u.x - 1.0f : u.x;
+		u.y = u.y >= 1.0f ? u.y - 1.0f : u.y;
+		return glm::vec2(std::min(u.x, 0.99999994f), std::min(u.y, 0.99999994f));
+	}
+};
+
+// Uniform point on a disc of unit radius facing dir.
+inline glm::vec3 sampleDisc(glm::vec2 u, glm::vec3 dir){
+	glm::vec3 t = glm::normalize(glm::cross(std::abs(dir.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f), dir));
+	glm::vec3 b = glm::cross(dir, t);
+	float r = std::sqrt(u.x), phi = 2.0f * glm::pi<float>() * u.y;
+	return t * (r * std::cos(phi)) + b * (r * std::sin(phi));
+}
@@ -0,0 +1,226 @@
+// Plain text scenes, one statement per line, '#' starts a comment.
+//
+// The scene itself:
+//   material <name> <diffuse|reflective|checkered|spherecheckered> <pbr x y z> <r g b> <specular>
+//   sphere <x y z> <radius> <material name>
+//   plane <x y z> <normal x y z> <material name>
+//   light <x y z> <r g b> <intensity> [radius]
+//
+// How to render it (all optional):
+//   size <width> <height>          samples <n>            seed <n>
+//   camera <eye x y z> <target x y z> <fov degrees>
+//   ortho <view height>            dof <lens radius> <focus distance>
+//   wavefront      raster          progressive
+//   shadow-maps <resolution> [bias]  math <reference|fast>
+//   bvh <none|full|lazy> [median|sah|morton] [binary|wide]
+//   sampler <random|stratified|halton|sobol> [blue-noise]
+//   time-budget <seconds>          ray-budget <rays>
+//   output <file.png>
+//
+// Scene statements and render statements are split apart so that the scene
+// can be cached by the hash of its own text, whatever camera looks at it.
+
+inline uint64_t hashText(const std::string &text){
+	uint64_t h = 14695981039346656037ull;
+	for(unsigned char c : text){
+		h ^= c;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+inline bool isSceneStatement(const std::string &keyword){
+	return keyword == "material" || keyword == "sphere" || keyword == "plane" || keyword == "light";
+}
+
+// Splits a description into scene and render statements, with comments and
+// extra whitespace dropped so that the scene hash only changes with content.
+inline void splitDescription(const std::string &text, std::string &sceneText, std::string &jobText){
+	std::istringstream in(text);
+	std::string line;
+	sceneText.clear();
+	jobText.clear();
+	while(std::getline(in, line)){
+		line = line.substr(0, line.find('#'));
+		std::istringstream words(line);
+		std::string word, normalized;
+		while(words >> word) normalized += (normalized.empty() ? "" : " ") + word;
+		if(normalized.empty()) continue;
+		std::string keyword = normalized.substr(0, normalized.find(' '));
+		(isSceneStatement(keyword) ? sceneText : jobText) += normalized + "\n";
+	}
+}
+
+inline bool parseMaterialType(const std::string &name, MaterialType &type){
+	const std::pair<const char*, MaterialType> names[] = {
+		{"diffuse", Diffuse}, {"reflective", Reflective}, {"checkered", Checkered}, {"spherecheckered", SphereCheckered}
+	};
+	for(auto &n : names)
+		if(name == n.first){ type = n.second; return true; }
+	return false;
+}
+
+inline bool parseMathTier(const std::string &name, MathTier &tier){
+	if(name == "reference") tier = ReferenceMath;
+	else if(name == "fast") tier = FastMath;
+	else return false;
+	return true;
+}
+
+inline bool parseSamplerType(const std::string &name, SamplerType &type){
+	if(name == "random") type = RandomSampler;
+	else if(name == "stratified") type = StratifiedSampler;
+	else if(name == "halton") type = HaltonSampler;
+	else if(name == "sobol") type = SobolSampler;
+	else return false;
+	return true;
+}
+
+inline bool parseBvhBuild(const std::string &name, BvhBuild &build){
+	if(name == "none") build = NoBvh;
+	else if(name == "full") build = FullBvh;
+	else if(name == "lazy") build = LazyBvh;
+	else return false;
+	return true;
+}
+
+inline bool parseBvhSplit(const std::string &name, BvhSplit &split){
+	if(name == "median") split = MedianSplit;
+	else if(name == "sah") split = SahSplit;
+	else if(name == "morton") split = MortonSplit;
+	else return false;
+	return true;
+}
+
+inline bool parseBvhLayout(const std::string &name, BvhLayout &layout){
+	if(name == "binary") layout = BinaryBvh;
+	else if(name == "wide") layout = WideBvh;
+	else return false;
+	return true;
+}
+
+inline bool readVec3(std::istream &in, glm::vec3 &v){
+	return (bool)(in >> v.x >> v.y >> v.z);
+}
+
+inline bool parseSceneText(const std::string &text, Scene &scene, std::string &error){
+	std::istringstream in(text);
+	std::string line;
+	for(int lineNumber = 1; std::getline(in, line); lineNumber++){
+		std::istringstream words(line);
+		std::string keyword, name;
+		words >> keyword;
+		glm::vec3 a, b;
+		float f = 0.0f, radius = 0.0f;
+		bool ok = false;
+		if(keyword == "material"){
+			std::string typeName;
+			MaterialType type;
+			ok = words >> name >> typeName && parseMaterialType(typeName, type) && readVec3(words, a) && readVec3(words, b) && words >> f;
+			if(ok) scene.addMaterial(Material(a, b, f, type), name);
+		}
+		else if(keyword == "sphere" || keyword == "plane"){
+			ok = readVec3(words, a) && (keyword == "sphere" ? (bool)(words >> f) : readVec3(words, b)) && words >> name;
+			int material = -1;
+			for(size_t m = 0; m < scene.materials.size(); m++)
+				if(scene.materials[m].name == name) material = (int)m;
+			if(ok && material < 0){
+				error = "line " + std::to_string(lineNumber) + ": unknown material " + name;
+				return false;
+			}
+			if(ok && keyword == "sphere") scene.addSphere(a, f, material);
+			else if(ok) scene.addPlane(a, glm::normalize(b), material);
+		}
+		else if(keyword == "light"){
+			ok = readVec3(words, a) && readVec3(words, b) && words >> f;
+			if(ok && !(words >> radius)) radius = 0.0f;
+			if(ok) scene.addLight(Light(a, b, f, radius));
+		}
+		if(!ok){
+			error = "line " + std::to_string(lineNumber) + ": can't read " + line;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Render statements, with main's defaults for anything left out.
+struct JobDescription{
+	RenderSettings settings;
+	glm::vec3 eye = glm::vec3(4.2f, 0.0f, 3.0f), target = glm::vec3(4.2f, 0.0f, 3.0f) + glm::vec3(-0.258819f, 0.0f, -0.965926f);
+	float fov = 45.0f, orthoHeight = 0.0f;
+	glm::vec2 depthOfField;
+	std::string output = "render.png";
+
+	Camera camera() const{
+		Camera cam = Camera::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(fov), settings.width, settings.height);
+		if(orthoHeight > 0.0f) cam.setOrthographic(orthoHeight);
+		if(depthOfField.x > 0.0f) cam.setDepthOfField(depthOfField.x, depthOfField.y);
+		return cam;
+	}
+};
+
+inline bool parseJobText(const std::string &text, JobDescription &job, std::string &error){
+	std::istringstream in(text);
+	std::string line;
+	while(std::getline(in, line)){
+		std::istringstream words(line);
+		std::string keyword;
+		words >> keyword;
+		RenderSettings &s = job.settings;
+		bool ok = true;
+		if(keyword == "size") ok = words >> s.width >> s.height && s.width > 0 && s.height > 0;
+		else if(keyword == "samples") ok = words >> s.samples && s.samples > 0;
+		else if(keyword == "seed") ok = (bool)(words >> s.seed);
+		else if(keyword == "camera") ok = readVec3(words, job.eye) && readVec3(words, job.target) && words >> job.fov;
+		else if(keyword == "ortho") ok = (bool)(words >> job.orthoHeight);
+		else if(keyword == "dof") ok = (bool)(words >> job.depthOfField.x >> job.depthOfField.y);
+		else if(keyword == "wavefront") s.wavefront = true;
+		else if(keyword == "raster") s.rasterPrimary = true;
+		else if(keyword == "bvh"){
+			std::string build, split, layout;
+			ok = words >> build && parseBvhBuild(build, s.bvh);
+			if(ok && words >> split) ok = parseBvhSplit(split, s.bvhSplit);
+			if(ok && words >> layout) ok = parseBvhLayout(layout, s.bvhLayout);
+		}
+		else if(keyword == "sampler"){
+			std::string type, option;
+			ok = words >> type && parseSamplerType(type, s.sampler);
+			if(ok && words >> option) ok = option == "blue-noise";
+			s.blueNoise = ok && option == "blue-noise";
+		}
+		else if(keyword == "math"){
+			std::string tier;
+			ok = words >> tier && parseMathTier(tier, s.math);
+		}
+		else if(keyword == "shadow-maps"){
+			ok = words >> s.shadowMapResolution && s.shadowMapResolution > 0;
+			float bias;
+			if(ok && words >> bias) s.shadowMapBias = bias;
+		}
+		else if(keyword == "progressive") s.progressive = true;
+		else if(keyword == "time-budget") ok = words >> s.timeBudget && s.timeBudget >= 0.0f;
+		else if(keyword == "ray-budget"){
+			// Below 2^64, so the conversion is defined.
+			double rays = 0.0;
+			ok = words >> rays && rays >= 0.0 && rays < 18446744073709551616.0;
+			if(ok) s.rayBudget = (uint64_t)rays;
+		}
+		else if(keyword == "output") ok = (bool)(words >> job.output);
+		else ok = false;
+		if(!ok){
+			error = "can't read " + line;
+			return false;
+		}
+	}
+	return true;
+}
+
+inline bool readTextFile(const std::string &filename, std::string &text){
+	std::ifstream file(filename, std::ios::binary);
+	if(!file) return false;
+	std::ostringstream contents;
+	contents << file.rdbuf();
+	text = contents.str();
+	return true;
+}
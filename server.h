@@ -0,0 +1,301 @@
+// Render server: one Renderer and a cache of parsed scenes kept warm between
+// jobs, taking requests over a Unix socket. One request per connection, sent
+// in full before the client shuts down its side:
+//   metrics            one line of JSON (queue depth, rays/sec, cache hit rate...)
+//   shutdown           finishes the jobs already queued, then exits
+//   anything else      a scene description (see sceneFile.h) to render. The
+//                      PNG goes to its output file, under the server's output
+//                      directory, and the answer is "ok ..." or "error ..."
+//
+// Clients can't write outside of the output directory: absolute output names
+// and ones with a ".." in them are refused. Nor can they have the server
+// allocate what it can't: images over maxPixels are refused too.
+
+#include "sceneFile.h"
+#include <deque>
+#include <list>
+#include <future>
+#include <csignal>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+// Parsed scenes by the hash of their text, least recently used dropped first.
+// A cached Scene also keeps its per node copies, so a hit skips those too.
+struct SceneCache{
+	size_t capacity;
+	std::list<std::pair<uint64_t, std::shared_ptr<Scene>>> entries; // most recent first
+	uint64_t hits = 0, misses = 0;
+	std::mutex mutex;
+
+	SceneCache(size_t c) : capacity(c) {}
+
+	std::shared_ptr<Scene> find(uint64_t key){
+		std::lock_guard<std::mutex> lock(mutex);
+		for(auto entry = entries.begin(); entry != entries.end(); entry++)
+			if(entry->first == key){
+				entries.splice(entries.begin(), entries, entry);
+				hits++;
+				return entries.front().second;
+			}
+		misses++;
+		return nullptr;
+	}
+
+	void insert(uint64_t key, std::shared_ptr<Scene> scene){
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.emplace_front(key, scene);
+		if(entries.size() > capacity) entries.pop_back();
+	}
+};
+
+// Where a job's output goes: its name under the output directory, unless the
+// name could reach outside of it.
+inline bool resolveOutput(const std::string &directory, const std::string &name, std::string &path){
+	std::filesystem::path relative(name);
+	if(name.empty() || relative.has_root_name() || relative.has_root_directory()) return false;
+	for(const std::filesystem::path &part : relative)
+		if(part == "..") return false;
+	path = (std::filesystem::path(directory) / relative).string();
+	return true;
+}
+
+struct ServerJob{
+	std::string text;
+	std::promise<std::string> reply;
+};
+
+struct RenderServer{
+	Renderer &renderer;
+	SceneCache scenes;
+	int concurrentJobs;
+	std::string outputDirectory = ".";
+	size_t maxPixels = (size_t)8192 * 8192;
+
+	std::deque<std::shared_ptr<ServerJob>> queue;
+	std::vector<std::thread> dispatchers;
+	int running = 0, connections = 0;
+	bool stopping = false;
+	uint64_t jobsDone = 0, jobsFailed = 0, rays = 0;
+	double busySeconds = 0.0; // wall time with at least one job running
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now(), busySince;
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	// More than one job at a time lets one be parsed and encoded while the
+	// pool renders another; the renders themselves still take turns.
+	RenderServer(Renderer &r, int jobs = 2, size_t cachedScenes = 16) : renderer(r), scenes(cachedScenes), concurrentJobs(std::max(1, jobs)) {}
+
+	std::string runJob(const std::string &text){
+		std::string sceneText, jobText, error;
+		JobDescription job;
+		splitDescription(text, sceneText, jobText);
+		if(sceneText.empty()) return "error no scene in the request";
+		if(!parseJobText(jobText, job, error)) return "error " + error;
+		const RenderSettings &settings = job.settings;
+		if((size_t)settings.width * settings.height > maxPixels)
+			return "error size " + std::to_string(settings.width) + "x" + std::to_string(settings.height) + " is over the server's limit of " +
+				std::to_string(maxPixels) + " pixels";
+		std::string output;
+		if(!resolveOutput(outputDirectory, job.output, output)) return "error output " + job.output + " must be a relative path without ..";
+
+		const uint64_t key = hashText(sceneText);
+		std::shared_ptr<Scene> scene = scenes.find(key);
+		const bool cached = scene != nullptr;
+		if(!cached){
+			scene = std::make_shared<Scene>();
+			if(!parseSceneText(sceneText, *scene, error)) return "error " + error;
+			scenes.insert(key, scene);
+		}
+
+		FirstTouchBuffer<glm::vec3> color;
+		color.resize((size_t)settings.width * settings.height);
+		RenderTarget target;
+		target.color = color.data();
+		RenderStats stats;
+		if(!renderer.render(*scene, job.camera(), settings, target, stats)) return "error " + stats.error;
+		if(!writePNG(output, settings.width, settings.height, color.data())) return "error couldn't write " + job.output;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			rays += stats.rays;
+		}
+		std::ostringstream reply;
+		reply << "ok " << job.output << " " << stats.seconds << "s " << stats.rays << " rays, scene " << (cached ? "cached" : "parsed");
+		return reply.str();
+	}
+
+	void dispatch(){
+		std::unique_lock<std::mutex> lock(mutex);
+		for(;;){
+			wake.wait(lock, [this]{ return !queue.empty() || stopping; });
+			if(queue.empty()) return;
+			std::shared_ptr<ServerJob> job = queue.front();
+			queue.pop_front();
+			if(running++ == 0) busySince = std::chrono::steady_clock::now();
+			lock.unlock();
+			std::string reply;
+			try { reply = runJob(job->text); }
+			catch(const std::exception &e) { reply = std::string("error ") + e.what(); }
+			lock.lock();
+			(reply.compare(0, 2, "ok") ? jobsFailed : jobsDone)++;
+			if(--running == 0) busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - busySince).count();
+			job->reply.set_value(reply);
+		}
+	}
+
+	// Queues a job and waits for its answer.
+	std::string submit(const std::string &text){
+		std::shared_ptr<ServerJob> job = std::make_shared<ServerJob>();
+		job->text = text;
+		std::future<std::string> reply = job->reply.get_future();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(stopping) return "error shutting down";
+			queue.push_back(job);
+		}
+		wake.notify_one();
+		return reply.get();
+	}
+
+	std::string metrics(){
+		uint64_t hits, misses;
+		size_t cached;
+		{
+			std::lock_guard<std::mutex> lock(scenes.mutex);
+			hits = scenes.hits;
+			misses = scenes.misses;
+			cached = scenes.entries.size();
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		auto now = std::chrono::steady_clock::now();
+		double busy = busySeconds + (running ? std::chrono::duration<double>(now - busySince).count() : 0.0);
+		std::ostringstream json;
+		json << "{\"queue_depth\":" << queue.size() << ",\"running\":" << running
+			<< ",\"jobs_done\":" << jobsDone << ",\"jobs_failed\":" << jobsFailed
+			<< ",\"rays\":" << rays << ",\"busy_seconds\":" << busy << ",\"rays_per_sec\":" << (busy > 0.0 ? rays / busy : 0.0)
+			<< ",\"cache_hits\":" << hits << ",\"cache_misses\":" << misses
+			<< ",\"cache_hit_rate\":" << (hits + misses ? (double)hits / (hits + misses) : 0.0) << ",\"cached_scenes\":" << cached
+			<< ",\"uptime\":" << std::chrono::duration<double>(now - started).count() << "}";
+		return json.str();
+	}
+
+#ifndef _WIN32
+	int listener = -1;
+
+	void handle(int connection){
+		std::string request, reply;
+		char buffer[4096];
+		ssize_t n;
+		while((n = recv(connection, buffer, sizeof(buffer), 0)) > 0) request.append(buffer, n);
+		std::string command;
+		std::istringstream(request) >> command;
+		if(command == "metrics") reply = metrics();
+		else if(command == "shutdown"){
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			::shutdown(listener, SHUT_RDWR); // wakes up accept
+			reply = "ok shutting down";
+		}
+		else reply = submit(request);
+		reply += "\n";
+		for(size_t sent = 0; sent < reply.size() && (n = send(connection, reply.data() + sent, reply.size() - sent, 0)) > 0; sent += n);
+		close(connection);
+	}
+
+	// Serves until a shutdown request comes in.
+	bool serve(const std::string &path){
+		sockaddr_un address = {};
+		address.sun_family = AF_UNIX;
+		if(path.size() >= sizeof(address.sun_path)){
+			std::cerr << "Socket path too long: " << path << std::endl;
+			return false;
+		}
+		memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+		// A socket file nobody answers on is left over from a server that died.
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(listener >= 0 && connect(listener, (sockaddr*)&address, sizeof(address)) == 0){
+			std::cerr << "Another server is already running on " << path << std::endl;
+			close(listener);
+			return false;
+		}
+		if(listener >= 0) close(listener);
+		unlink(path.c_str());
+		listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) || listen(listener, 64)){
+			std::cerr << "Couldn't listen on " << path << ": " << strerror(errno) << std::endl;
+			if(listener >= 0) close(listener);
+			return false;
+		}
+		std::signal(SIGPIPE, SIG_IGN); // clients hanging up early
+		for(int t = 0; t < concurrentJobs; t++) dispatchers.emplace_back([this]{ dispatch(); });
+		std::cout << "Serving on " << path << std::endl;
+
+		for(;;){
+			int connection = accept(listener, nullptr, nullptr);
+			std::unique_lock<std::mutex> lock(mutex);
+			if(connection < 0){
+				if(errno == EINTR && !stopping) continue;
+				stopping = true;
+				break;
+			}
+			connections++;
+			std::thread([this, connection]{
+				handle(connection);
+				std::lock_guard<std::mutex> lock(mutex);
+				connections--;
+				wake.notify_all();
+			}).detach();
+		}
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]{ return connections == 0; });
+		}
+		wake.notify_all();
+		for(auto &dispatcher : dispatchers) dispatcher.join();
+		dispatchers.clear();
+		close(listener);
+		unlink(path.c_str());
+		return true;
+	}
+#else
+	bool serve(const std::string &path){
+		std::cerr << "The render server needs Unix sockets" << std::endl;
+		return false;
+	}
+#endif
+};
+
+// Client side: sends one request, returns the answer (false if there's no
+// server to talk to).
+inline bool sendRequest(const std::string &path, const std::string &request, std::string &reply){
+#ifndef _WIN32
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(address.sun_path)) return false;
+	memcpy(address.sun_path, path.c_str(), path.size() + 1);
+	int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(connection < 0) return false;
+	if(connect(connection, (sockaddr*)&address, sizeof(address))){
+		close(connection);
+		return false;
+	}
+	ssize_t n = 0;
+	for(size_t sent = 0; sent < request.size() && (n = send(connection, request.data() + sent, request.size() - sent, 0)) > 0; sent += n);
+	shutdown(connection, SHUT_WR);
+	char buffer[4096];
+	reply.clear();
+	while((n = recv(connection, buffer, sizeof(buffer), 0)) > 0) reply.append(buffer, n);
+	close(connection);
+	return n == 0;
+#else
+	return false;
+#endif
+}
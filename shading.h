@@ -0,0 +1,106 @@
+// Per-material shading kernels for the wavefront integrator. Hits are binned
+// by MaterialType first, so the material switch runs once per bin instead of
+// once per hit and each kernel is compiled for exactly one type.
+
+// One bounce of a path: colour = clamp(direct + ((next * k1) * k2) * tint),
+// with the same operation order as cast_ray.
+struct PathVertex{
+	glm::vec3 direct, tint;
+	float k1 = 0.0f, k2 = 0.0f;
+};
+
+// Material::returnCheckered over a batch of hit points, odd[i] set where it
+// picks the dark square. Same double precision arithmetic as the scalar version.
+inline void checkerBatch(int n, const float *x, const float *z, uint8_t *odd){
+	#pragma omp simd
+	for(int i = 0; i < n; i++){
+		int a = (int)(.8 * x[i] + 1000), b = (int)(.8 * z[i]);
+		odd[i] = (a + b) & 1;
+	}
+}
+
+// Material::returnSphereCheckered over a batch of normals. u and v are
+// scratch space; in the reference tier atan/asin stay libm calls so results
+// match cast_ray exactly, the fast tier's vectorize.
+inline void sphereCheckerBatch(int n, const float *nx, const float *ny, const float *nz, float *u, float *v, uint8_t *odd){
+	if(shadingMath == FastMath){
+		#pragma omp simd
+		for(int i = 0; i < n; i++){
+			u[i] = fastAtan2(nx[i], nz[i]) / (2.0f * glm::pi<float>()) + 0.5f;
+			v[i] = fastAsin(ny[i]) / glm::pi<float>() + 0.5f;
+		}
+	}
+	else{
+		for(int i = 0; i < n; i++){
+			u[i] = glm::atan(nx[i], nz[i]) / (2.0f * glm::pi<float>()) + 0.5f;
+			v[i] = glm::asin(ny[i]) / glm::pi<float>() + 0.5f;
+		}
+	}
+	#pragma omp simd
+	for(int i = 0; i < n; i++)
+		odd[i] = ((int)(std::floor(16.0f * u[i]) + std::floor(10.0f * v[i])) % 2) != 0;
+}
+
+// Scratch arrays reused between bins.
+struct ShadeScratch{
+	std::vector<float> a, b, c, u, v;
+	std::vector<uint8_t> odd;
+	void resize(size_t n){
+		for(auto *s : {&a, &b, &c, &u, &v}) s->resize(n);
+		odd.resize(n);
+	}
+};
+
+// Default kernel: plain colour, no reflection (Diffuse and friends).
+template<MaterialType Type> struct SurfaceKernel{
+	static void albedo(const std::vector<hitHistory> &hits, const std::vector<int> &bin, ShadeScratch &, std::vector<glm::vec3> &out){
+		for(size_t i = 0; i < bin.size(); i++)
+			out[i] = hits[bin[i]].obtMat->color;
+	}
+	static void vertex(PathVertex &v, const Material &mat, glm::vec3 albedo, float totalDt, glm::vec3 specular, glm::vec3){
+		v.direct = albedo * totalDt * mat.pbrCtrl.x + specular;
+	}
+};
+
+template<> struct SurfaceKernel<Reflective>{
+	static void albedo(const std::vector<hitHistory> &hits, const std::vector<int> &bin, ShadeScratch &s, std::vector<glm::vec3> &out){
+		SurfaceKernel<Diffuse>::albedo(hits, bin, s, out);
+	}
+	static void vertex(PathVertex &v, const Material &mat, glm::vec3, float totalDt, glm::vec3, glm::vec3 lightColor){
+		v.k1 = totalDt; v.k2 = mat.pbrCtrl.z; v.tint = lightColor;
+	}
+};
+
+template<> struct SurfaceKernel<Checkered>{
+	static void albedo(const std::vector<hitHistory> &hits, const std::vector<int> &bin, ShadeScratch &s, std::vector<glm::vec3> &out){
+		const int n = (int)bin.size();
+		for(int i = 0; i < n; i++){
+			s.a[i] = hits[bin[i]].hitPoint.x;
+			s.b[i] = hits[bin[i]].hitPoint.z;
+		}
+		checkerBatch(n, s.a.data(), s.b.data(), s.odd.data());
+		for(int i = 0; i < n; i++)
+			out[i] = s.odd[i] ? glm::vec3(0.1f) : hits[bin[i]].obtMat->color;
+	}
+	static void vertex(PathVertex &v, const Material &mat, glm::vec3 albedo, float totalDt, glm::vec3 specular, glm::vec3){
+		v.direct = albedo * totalDt * mat.pbrCtrl.x + specular;
+		v.k1 = mat.pbrCtrl.z; v.k2 = 1.0f; v.tint = glm::vec3(1.0f);
+	}
+};
+
+template<> struct SurfaceKernel<SphereCheckered>{
+	static void albedo(const std::vector<hitHistory> &hits, const std::vector<int> &bin, ShadeScratch &s, std::vector<glm::vec3> &out){
+		const int n = (int)bin.size();
+		for(int i = 0; i < n; i++){
+			s.a[i] = hits[bin[i]].normal.x;
+			s.b[i] = hits[bin[i]].normal.y;
+			s.c[i] = hits[bin[i]].normal.z;
+		}
+		sphereCheckerBatch(n, s.a.data(), s.b.data(), s.c.data(), s.u.data(), s.v.data(), s.odd.data());
+		for(int i = 0; i < n; i++)
+			out[i] = s.odd[i] ? glm::vec3(0.9f) : hits[bin[i]].obtMat->color;
+	}
+	static void vertex(PathVertex &v, const Material &mat, glm::vec3 albedo, float totalDt, glm::vec3 specular, glm::vec3 lightColor){
+		SurfaceKernel<Checkered>::vertex(v, mat, albedo, totalDt, specular, lightColor);
+	}
+};
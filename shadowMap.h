@@ -0,0 +1,76 @@
+// Cube shadow maps, for previews: per light, the distance from its center to
+// the closest surface in every direction, ray cast once per render. Shading
+// then looks a light's visibility up instead of tracing a shadow ray. Area
+// lights cast shadows from their center, so soft shadows come out hard.
+//
+// Face f looks down axis f / 2 (positive for even f); texel (i, j) of it has
+// the direction with 1 on that axis and u, v in [-1, 1] on the next two.
+
+struct CubeShadowMap{
+	glm::vec3 center;
+	int resolution = 0;
+	float bias = 0.0f;
+	std::vector<float> depth; // face major, then rows
+
+	void init(glm::vec3 c, int res, float b){
+		center = c;
+		resolution = res;
+		bias = b;
+		depth.assign((size_t)6 * res * res, std::numeric_limits<float>::max());
+	}
+
+	// Row is face * resolution + j. With a hierarchy over stuff, only the
+	// unbounded objects are tested one by one.
+	void buildRow(int row, const std::vector<Object*> &stuff, const BVH *bvh){
+		const int face = row / resolution, j = row % resolution, axis = face >> 1;
+		for(int i = 0; i < resolution; i++){
+			glm::vec3 d;
+			d[axis] = face & 1 ? -1.0f : 1.0f;
+			d[(axis + 1) % 3] = (i + 0.5f) / resolution * 2.0f - 1.0f;
+			d[(axis + 2) % 3] = (j + 0.5f) / resolution * 2.0f - 1.0f;
+			Ray ray(center, glm::normalize(d));
+			float &closest = depth[(size_t)row * resolution + i];
+			auto test = [&](Object *object){
+				float dist;
+				if(object->intersect(ray, dist) && dist < closest) closest = dist;
+			};
+			if(bvh){
+				int object = -1;
+				for(int o : bvh->unbounded) test(stuff[o]);
+				bvh->intersect(ray, closest, object);
+			}
+			else
+				for(Object *object : stuff) test(object);
+		}
+	}
+
+	// How much of the light reaches a hit point, 0 to 1: the 2x2 texels
+	// around its direction are depth tested and blended bilinearly.
+	float visibility(glm::vec3 hitPoint, glm::vec3 normal, glm::vec3 L) const{
+		// Pushed off the surface by about a texel's footprint, so surfaces at
+		// grazing angles don't shadow themselves between texel centers.
+		glm::vec3 toPoint = hitPoint - center;
+		glm::vec3 a = glm::abs(toPoint);
+		const float texel = 2.0f * std::max(a.x, std::max(a.y, a.z)) / resolution;
+		glm::vec3 d = toPoint + (glm::dot(L, normal) < 0 ? -normal : normal) * (1e-3f + 1.5f * texel);
+		a = glm::abs(d);
+		const int axis = a.x >= a.y && a.x >= a.z ? 0 : a.y >= a.z ? 1 : 2;
+		const int face = axis * 2 + (d[axis] < 0.0f);
+		const float x = (d[(axis + 1) % 3] / a[axis] + 1.0f) * 0.5f * resolution - 0.5f;
+		const float y = (d[(axis + 2) % 3] / a[axis] + 1.0f) * 0.5f * resolution - 0.5f;
+		const int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+		const float fx = x - x0, fy = y - y0, dist = glm::length(d) - bias;
+		auto lit = [&](int i, int j){
+			i = std::min(std::max(i, 0), resolution - 1);
+			j = std::min(std::max(j, 0), resolution - 1);
+			return depth[((size_t)face * resolution + j) * resolution + i] >= dist ? 1.0f : 0.0f;
+		};
+		return (lit(x0, y0) * (1.0f - fx) + lit(x0 + 1, y0) * fx) * (1.0f - fy) +
+			(lit(x0, y0 + 1) * (1.0f - fx) + lit(x0 + 1, y0 + 1) * fx) * fy;
+	}
+
+	size_t bytes() const{ return depth.size() * sizeof(float); }
+};
+
+// One map per light, set by the renderer around tiles rendered with them.
+thread_local const std::vector<CubeShadowMap> *previewShadows = nullptr;
@@ -0,0 +1,261 @@
+// Persistent worker pool that knows about NUMA nodes. Workers are spread over
+// the nodes and can be pinned, every node gets its own tile queue (idle
+// workers steal from the other nodes once theirs is empty), and buffers are
+// first touched by the workers of the node that will write them, so their
+// pages end up in that node's memory.
+//
+// Topology comes from sysfs on Linux. Everywhere else the machine is treated
+// as a single node and pinning is a no-op.
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+enum PinMode{
+	PinNone, PinNode, PinCore
+};
+
+struct NumaTopology{
+	std::vector<std::vector<int>> nodeCpus;
+
+	// "0-3,8-11" style lists, as found in /sys/devices/system/node/node*/cpulist.
+	static std::vector<int> parseCpuList(const std::string &list){
+		std::vector<int> cpus;
+		size_t start = 0;
+		while(start < list.size()){
+			size_t end = std::min(list.find(',', start), list.size());
+			std::string item = list.substr(start, end - start);
+			size_t dash = item.find('-');
+			try{
+				int first = std::stoi(item), last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+				for(int c = first; c <= last; c++) cpus.push_back(c);
+			}
+			catch(...){}
+			start = end + 1;
+		}
+		return cpus;
+	}
+
+	static NumaTopology detect(){
+		NumaTopology topology;
+#ifdef __linux__
+		for(int node = 0; ; node++){
+			std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+			std::string list;
+			if(!file || !std::getline(file, list)) break;
+			std::vector<int> cpus = parseCpuList(list);
+			if(!cpus.empty()) topology.nodeCpus.push_back(cpus);
+		}
+#endif
+		if(topology.nodeCpus.empty()){
+			int count = std::max(1u, std::thread::hardware_concurrency());
+			topology.nodeCpus.emplace_back();
+			for(int c = 0; c < count; c++) topology.nodeCpus[0].push_back(c);
+		}
+		return topology;
+	}
+
+	int nodeCount() const{ return (int)nodeCpus.size(); }
+};
+
+inline bool pinThread(std::thread &thread, const std::vector<int> &cpus){
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(int c : cpus) CPU_SET(c, &set);
+	return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+	return false;
+#endif
+}
+
+// Heap buffer that is allocated but not written, so that each page is placed
+// on the node of whoever touches it first (see ThreadPool::firstTouch).
+// Only meant for plain data.
+template<typename T> struct FirstTouchBuffer{
+	T *items = nullptr;
+	size_t count = 0;
+
+	FirstTouchBuffer() = default;
+	FirstTouchBuffer(const FirstTouchBuffer&) = delete;
+	FirstTouchBuffer &operator=(const FirstTouchBuffer&) = delete;
+	~FirstTouchBuffer(){ free(items); }
+
+	void resize(size_t n){
+		free(items);
+		items = n ? (T*)malloc(n * sizeof(T)) : nullptr;
+		count = n;
+	}
+	T &operator[](size_t i){ return items[i]; }
+	const T &operator[](size_t i) const{ return items[i]; }
+	T *data(){ return items; }
+	size_t size() const{ return count; }
+	bool empty() const{ return count == 0; }
+};
+
+// Set once to stop handing out tiles. Workers check it between tiles, so a
+// cancelled run finishes the tiles in flight and then returns. cancel() is
+// a lock-free store and safe to call from a signal handler.
+struct CancellationToken{
+	std::atomic<bool> flag{false};
+
+	void cancel(){ flag.store(true, std::memory_order_relaxed); }
+	bool cancelled() const{ return flag.load(std::memory_order_relaxed); }
+};
+
+// Work done on each node over the pool's life, for the end of render report.
+struct NodeStats{
+	std::atomic<uint64_t> tiles{0}, stolen{0}, pixels{0}, nanoseconds{0};
+};
+
+// A copy of one node's counters at some point; reports print the difference
+// of two, so each covers just the renders in between.
+struct NodeWork{
+	uint64_t tiles = 0, stolen = 0, pixels = 0, nanoseconds = 0;
+};
+
+struct ThreadPool{
+	NumaTopology topology;
+	std::vector<int> workerNode;
+	std::vector<std::thread> workers;
+	std::unique_ptr<NodeStats[]> nodeStats;
+
+	std::mutex mutex, jobMutex;
+	std::condition_variable wake, finished;
+	std::function<void(int)> job;
+	uint64_t generation = 0;
+	int running = 0;
+	bool stopping = false;
+
+	// Workers go round robin over the nodes, so a partial pool still uses all
+	// of them. PinCore gives each worker a core of its node, PinNode lets it
+	// float within the node.
+	ThreadPool(const NumaTopology &t, int threadCount, PinMode pin) : topology(t) {
+		threadCount = std::max(threadCount, 1);
+		// Nodes without a worker would never get their band touched.
+		if(topology.nodeCount() > threadCount) topology.nodeCpus.resize(threadCount);
+		const int nodes = topology.nodeCount();
+		nodeStats.reset(new NodeStats[nodes]);
+		for(int w = 0; w < threadCount; w++){
+			int node = w % nodes;
+			const std::vector<int> &cpus = topology.nodeCpus[node];
+			workerNode.push_back(node);
+			workers.emplace_back([this, w]{ run(w); });
+			if(pin == PinNode) pinThread(workers.back(), cpus);
+			else if(pin == PinCore) pinThread(workers.back(), {cpus[(w / nodes) % cpus.size()]});
+		}
+	}
+	~ThreadPool(){
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for(auto &worker : workers) worker.join();
+	}
+
+	int size() const{ return (int)workers.size(); }
+	int nodeCount() const{ return topology.nodeCount(); }
+	int nodeOf(int worker) const{ return workerNode[worker]; }
+	// The first worker of each node, for once per node jobs.
+	bool isNodeLeader(int worker) const{ return worker < nodeCount(); }
+
+	void run(int worker){
+		uint64_t seen = 0;
+		std::unique_lock<std::mutex> lock(mutex);
+		for(;;){
+			wake.wait(lock, [&]{ return stopping || generation != seen; });
+			if(stopping) return;
+			seen = generation;
+			lock.unlock();
+			job(worker);
+			lock.lock();
+			if(--running == 0) finished.notify_all();
+		}
+	}
+
+	// Runs fn(worker) once on every worker and waits for all of them. Calls
+	// from several threads take turns, each job gets the whole pool.
+	void broadcast(std::function<void(int)> fn){
+		std::lock_guard<std::mutex> turn(jobMutex);
+		std::unique_lock<std::mutex> lock(mutex);
+		job = std::move(fn);
+		running = size();
+		generation++;
+		wake.notify_all();
+		finished.wait(lock, [this]{ return running == 0; });
+	}
+
+	// Node owning a tile: tile rows are split into one band per node, so each
+	// node writes a contiguous part of the framebuffer.
+	int tileNode(int tileY, int tilesY) const{
+		return (int)((int64_t)tileY * nodeCount() / tilesY);
+	}
+
+	// Calls touchRows(y0, y1) for each node's band of pixel rows on a worker
+	// of that node, so the first write to those pages happens there.
+	void firstTouch(int height, int tileSize, const std::function<void(int, int)> &touchRows){
+		const int tilesY = (height + tileSize - 1) / tileSize;
+		broadcast([&](int worker){
+			if(!isNodeLeader(worker)) return;
+			int first = -1, last = -1;
+			for(int ty = 0; ty < tilesY; ty++)
+				if(tileNode(ty, tilesY) == nodeOf(worker)){
+					if(first < 0) first = ty;
+					last = ty;
+				}
+			if(first >= 0) touchRows(first * tileSize, std::min((last + 1) * tileSize, height));
+		});
+	}
+
+	// Runs fn(tile, worker) over every tile. nodeTiles[n] is node n's queue;
+	// fn returns the number of pixels it rendered, for the stats. Once cancel
+	// is set, no new tiles are started.
+	void runTiles(const std::vector<std::vector<int>> &nodeTiles, std::function<size_t(int, int)> fn, const CancellationToken *cancel = nullptr){
+		const int nodes = nodeCount();
+		std::unique_ptr<std::atomic<size_t>[]> cursor(new std::atomic<size_t>[nodes]);
+		for(int n = 0; n < nodes; n++) cursor[n] = 0;
+		broadcast([&](int worker){
+			const int home = nodeOf(worker);
+			for(int k = 0; k < nodes; k++){
+				const int node = (home + k) % nodes;
+				for(;;){
+					if(cancel && cancel->cancelled()) return;
+					size_t i = cursor[node]++;
+					if(i >= nodeTiles[node].size()) break;
+					auto start = std::chrono::steady_clock::now();
+					size_t pixels = fn(nodeTiles[node][i], worker);
+					NodeStats &stats = nodeStats[home];
+					stats.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+					stats.pixels += pixels;
+					if(pixels) stats.tiles++;
+					if(pixels && node != home) stats.stolen++;
+				}
+			}
+		});
+	}
+
+	std::vector<NodeWork> work() const{
+		std::vector<NodeWork> work(nodeCount());
+		for(int n = 0; n < nodeCount(); n++){
+			work[n].tiles = nodeStats[n].tiles;
+			work[n].stolen = nodeStats[n].stolen;
+			work[n].pixels = nodeStats[n].pixels;
+			work[n].nanoseconds = nodeStats[n].nanoseconds;
+		}
+		return work;
+	}
+
+	// The work done between two calls to work(). Renders running at the same
+	// time as the ones measured count too.
+	void report(std::ostream &out, const std::vector<NodeWork> &from, const std::vector<NodeWork> &to) const{
+		for(int n = 0; n < nodeCount(); n++){
+			int threads = (int)std::count(workerNode.begin(), workerNode.end(), n);
+			// Busy time is summed over the node's threads.
+			double seconds = (to[n].nanoseconds - from[n].nanoseconds) * 1e-9;
+			out << "Node " << n << ": " << threads << " threads, " << to[n].tiles - from[n].tiles << " tiles (" << to[n].stolen - from[n].stolen << " stolen), "
+				<< seconds << "s busy, " << (to[n].pixels - from[n].pixels) / std::max(seconds, 1e-9) * threads * 1e-6 << " Mpixels/s" << std::endl;
+		}
+	}
+};
@@ -0,0 +1,209 @@
+// On-disk cache of finished tiles, for re-rendering a scene after a small
+// edit. A tile's file is named by the hash of the camera, the settings that
+// change pixels and the tile's position; inside are its pixels and what its
+// rays touched (see TileDependencies), as content hashes. A tile is reused
+// when all of that is still in the scene unchanged and nothing new (an added
+// or edited object) reaches into its segment box. An added light only
+// spares the tiles that didn't shade anything.
+//
+// The objects and lights of every scene seen are kept alongside, in one file
+// per scene named by their hashes, to tell what is new.
+
+inline uint64_t hashBytes(uint64_t h, const void *data, size_t size){
+	const uint8_t *bytes = (const uint8_t*)data;
+	for(size_t i = 0; i < size; i++){
+		h ^= bytes[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+inline uint64_t materialHash(const Material &material){
+	uint64_t h = 14695981039346656037ull;
+	h = hashBytes(h, &material.pbrCtrl, sizeof(glm::vec3));
+	h = hashBytes(h, &material.color, sizeof(glm::vec3));
+	h = hashBytes(h, &material.specualirity, sizeof(float));
+	return hashBytes(h, &material.type, sizeof(MaterialType));
+}
+
+// Shape and material: objects carry their own copy of the material.
+inline uint64_t objectHash(const Object *object){
+	uint64_t h = materialHash(object->material);
+	h = hashBytes(h, &object->pos, sizeof(glm::vec3));
+	if(const Sphere *sphere = dynamic_cast<const Sphere*>(object))
+		h = hashBytes(h, &sphere->radius, sizeof(float));
+	if(const Plane *plane = dynamic_cast<const Plane*>(object))
+		h = hashBytes(h, &plane->normal, sizeof(glm::vec3));
+	return h;
+}
+
+inline uint64_t lightHash(const Light &light){
+	uint64_t h = 14695981039346656037ull;
+	h = hashBytes(h, &light.pos, sizeof(glm::vec3));
+	h = hashBytes(h, &light.color, sizeof(glm::vec3));
+	h = hashBytes(h, &light.intensity, sizeof(float));
+	return hashBytes(h, &light.radius, sizeof(float));
+}
+
+struct TileCacheHeader{
+	char magic[4] = {'R', 'D', 'T', 'C'};
+	uint32_t version = 1;
+	uint64_t scene = 0; // the scene it was rendered in
+	uint32_t pixels = 0, hasGuide = 0, unbounded = 0;
+	uint32_t objects = 0, materials = 0, lights = 0;
+	glm::vec3 lo, hi;
+};
+
+struct TileCache{
+	std::string directory;
+	uint64_t frameKey;
+	const std::vector<Object*> &objects;
+	std::vector<uint64_t> objectHashes, materialHashes, lightHashes; // by scene index
+	std::vector<uint64_t> sortedObjects, sortedMaterials, sortedLights;
+	uint64_t sceneKey;
+	std::map<uint64_t, std::pair<std::vector<uint64_t>, std::vector<uint64_t>>> knownScenes; // objects, lights
+	bool ok = true;
+
+	TileCache(const std::string &dir, uint64_t key, const std::vector<Object*> &o, const std::vector<Light> &lights) :
+		directory(dir), frameKey(key), objects(o) {
+		for(const Object *object : objects){
+			objectHashes.push_back(objectHash(object));
+			materialHashes.push_back(materialHash(object->material));
+		}
+		for(const Light &light : lights) lightHashes.push_back(lightHash(light));
+		sortedObjects = sorted(objectHashes);
+		sortedMaterials = sorted(materialHashes);
+		sortedLights = sorted(lightHashes);
+		sceneKey = hashBytes(hashBytes(14695981039346656037ull, sortedObjects.data(), sortedObjects.size() * 8), sortedLights.data(), sortedLights.size() * 8);
+
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		if(!std::filesystem::is_directory(directory)){
+			ok = false;
+			return;
+		}
+		std::string sceneFile = fileName(sceneKey, ".scene");
+		if(!std::filesystem::exists(sceneFile)){
+			FILE *f = fopen(sceneFile.c_str(), "wb");
+			ok = f && writeList(f, sortedObjects) && writeList(f, sortedLights);
+			if(f) ok = fclose(f) == 0 && ok;
+		}
+	}
+
+	static std::vector<uint64_t> sorted(std::vector<uint64_t> v){
+		std::sort(v.begin(), v.end());
+		return v;
+	}
+	static bool contains(const std::vector<uint64_t> &sortedList, uint64_t h){
+		return std::binary_search(sortedList.begin(), sortedList.end(), h);
+	}
+	static bool writeList(FILE *f, const std::vector<uint64_t> &list){
+		uint32_t n = list.size();
+		return fwrite(&n, 4, 1, f) == 1 && fwrite(list.data(), 8, n, f) == n;
+	}
+	static bool readList(FILE *f, std::vector<uint64_t> &list, uint32_t n){
+		list.resize(n);
+		return fread(list.data(), 8, n, f) == n;
+	}
+
+	std::string fileName(uint64_t key, const char *extension) const{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+		return directory + "/" + name + extension;
+	}
+	uint64_t tileKey(int tile) const{
+		return hashBytes(frameKey, &tile, sizeof(int));
+	}
+
+	// The object and light lists of a scene rendered before, loaded once.
+	const std::pair<std::vector<uint64_t>, std::vector<uint64_t>> *knownScene(uint64_t key){
+		auto found = knownScenes.find(key);
+		if(found != knownScenes.end()) return &found->second;
+		FILE *f = fopen(fileName(key, ".scene").c_str(), "rb");
+		if(!f) return nullptr;
+		std::pair<std::vector<uint64_t>, std::vector<uint64_t>> lists;
+		uint32_t n;
+		bool read = fread(&n, 4, 1, f) == 1 && readList(f, lists.first, n) && fread(&n, 4, 1, f) == 1 && readList(f, lists.second, n);
+		fclose(f);
+		return read ? &(knownScenes[key] = lists) : nullptr;
+	}
+
+	// Fills the tile from the cache if its entry is still good. Not thread safe.
+	bool load(int tile, FrameState &frame){
+		FILE *f = fopen(fileName(tileKey(tile), ".tile").c_str(), "rb");
+		if(!f) return false;
+		int x0, y0, x1, y1;
+		frame.tileBounds(tile, x0, y0, x1, y1);
+		TileCacheHeader header, expected;
+		std::vector<uint64_t> touchedObjects, touchedMaterials, touchedLights;
+		bool valid = fread(&header, sizeof(header), 1, f) == 1 && !memcmp(header.magic, expected.magic, 4) && header.version == expected.version &&
+			header.pixels == (uint32_t)((x1 - x0) * (y1 - y0)) && (header.hasGuide || !frame.guide) &&
+			readList(f, touchedObjects, header.objects) && readList(f, touchedMaterials, header.materials) && readList(f, touchedLights, header.lights);
+		for(uint64_t h : touchedObjects) valid = valid && contains(sortedObjects, h);
+		for(uint64_t h : touchedMaterials) valid = valid && contains(sortedMaterials, h);
+		for(uint64_t h : touchedLights) valid = valid && contains(sortedLights, h);
+
+		const std::pair<std::vector<uint64_t>, std::vector<uint64_t>> *before = valid && header.scene != sceneKey ? knownScene(header.scene) : nullptr;
+		if(valid && header.scene != sceneKey){
+			valid = before != nullptr;
+			for(size_t o = 0; valid && o < objects.size(); o++)
+				if(!contains(before->first, objectHashes[o]))
+					valid = !header.unbounded && !objects[o]->overlapsBox(header.lo, header.hi);
+			for(size_t l = 0; valid && l < lightHashes.size(); l++)
+				if(!contains(before->second, lightHashes[l]))
+					valid = header.lights == 0 && header.objects == 0;
+		}
+		for(int y = y0; y < y1 && valid; y++){
+			size_t row = (size_t)y * frame.width + x0, n = x1 - x0;
+			valid = fread(&frame.color[row], sizeof(glm::vec3), n, f) == n;
+		}
+		for(int y = y0; y < y1 && valid && header.hasGuide; y++){
+			size_t row = (size_t)y * frame.width + x0, n = x1 - x0;
+			if(frame.guide) valid = fread(&frame.guide[row], sizeof(GBufferSample), n, f) == n;
+		}
+		fclose(f);
+		return valid;
+	}
+
+	// Writes a freshly rendered tile. Safe to call from several threads for
+	// different tiles.
+	bool store(int tile, const TileDependencies &dependencies, const FrameState &frame) const{
+		std::vector<uint64_t> touchedObjects, touchedMaterials, touchedLights;
+		for(size_t o = 0; o < dependencies.objects.size(); o++)
+			if(dependencies.objects[o]){
+				touchedObjects.push_back(objectHashes[o]);
+				touchedMaterials.push_back(materialHashes[o]);
+			}
+		for(size_t l = 0; l < dependencies.lights.size(); l++)
+			if(dependencies.lights[l]) touchedLights.push_back(lightHashes[l]);
+		touchedMaterials = sorted(touchedMaterials);
+		touchedMaterials.erase(std::unique(touchedMaterials.begin(), touchedMaterials.end()), touchedMaterials.end());
+
+		int x0, y0, x1, y1;
+		frame.tileBounds(tile, x0, y0, x1, y1);
+		TileCacheHeader header;
+		header.scene = sceneKey;
+		header.pixels = (x1 - x0) * (y1 - y0);
+		header.hasGuide = frame.guide != nullptr;
+		header.unbounded = dependencies.unbounded;
+		header.objects = touchedObjects.size();
+		header.materials = touchedMaterials.size();
+		header.lights = touchedLights.size();
+		header.lo = dependencies.lo;
+		header.hi = dependencies.hi;
+
+		std::string name = fileName(tileKey(tile), ".tile"), temp = name + ".tmp";
+		FILE *f = fopen(temp.c_str(), "wb");
+		if(!f) return false;
+		bool written = fwrite(&header, sizeof(header), 1, f) == 1;
+		for(auto *list : {&touchedObjects, &touchedMaterials, &touchedLights})
+			written = written && fwrite(list->data(), 8, list->size(), f) == list->size();
+		for(int y = y0; y < y1 && written; y++)
+			written = fwrite(&frame.color[(size_t)y * frame.width + x0], sizeof(glm::vec3), x1 - x0, f) == (size_t)(x1 - x0);
+		for(int y = y0; y < y1 && written && frame.guide; y++)
+			written = fwrite(&frame.guide[(size_t)y * frame.width + x0], sizeof(GBufferSample), x1 - x0, f) == (size_t)(x1 - x0);
+		written = (fclose(f) == 0) && written;
+		std::remove(name.c_str());
+		return written && std::rename(temp.c_str(), name.c_str()) == 0;
+	}
+};
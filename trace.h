@@ -0,0 +1,195 @@
+// Depth-first path tracing: one ray at a time, recursing on reflections.
+
+// Rays intersected against the scene by the current thread, for progress reporting.
+thread_local uint64_t raysTraced = 0;
+
+bool sceneIntersection(Ray ray, const std::vector<Object*> &stuff, hitHistory &history){
+	raysTraced++;
+	float stuff_dist = std::numeric_limits<float>::max();
+	int closest = -1;
+	if(sceneBvh){
+		for(int o : sceneBvh->unbounded){
+			float dist_i = 0.0f;
+			if(stuff[o]->intersect(ray, dist_i) && dist_i < stuff_dist){
+				stuff_dist = dist_i;
+				closest = o;
+			}
+		}
+		sceneBvh->intersect(ray, stuff_dist, closest);
+		if(closest >= 0){
+			glm::vec3 hitPoint = ray.orig + ray.dir * stuff_dist;
+			history = hitHistory(stuff_dist, hitPoint, stuff[closest]->getNormal(hitPoint), stuff[closest]->material);
+		}
+	}
+	else
+		for(size_t o = 0; o < stuff.size(); o++){
+			Object *object = stuff[o];
+			float dist_i = 0.0f;
+			if(object->intersect(ray, dist_i) && dist_i < stuff_dist){
+				stuff_dist = dist_i;
+				closest = (int)o;
+				glm::vec3 hitPoint = ray.orig + ray.dir * dist_i;
+				hitHistory gotHist(dist_i, hitPoint, object->getNormal(hitPoint), object->material);
+				history = gotHist;
+			}
+		}
+	if(recordDependencies){
+		if(closest >= 0) recordDependencies->addHit(closest, ray.orig, history.hitPoint);
+		else recordDependencies->addMiss();
+	}
+    return stuff_dist < std::numeric_limits<float>::max();
+}
+
+// min/max rather than branches, same results (NaN included).
+glm::vec3 clampRay(glm::vec3 col){
+	return glm::vec3(std::min(std::max(col.x, 0.0f), 1.0f), std::min(std::max(col.y, 0.0f), 1.0f), std::min(std::max(col.z, 0.0f), 1.0f));
+}
+
+// Unit vector and distance from a hit point to a light, in the thread's
+// math tier. The fast tier takes one reciprocal square root for both.
+inline void towardsLight(glm::vec3 lightPos, glm::vec3 hitPoint, glm::vec3 &L, float &lightDist){
+	if(shadingMath == FastMath){
+		glm::vec3 d = lightPos - hitPoint;
+		float d2 = glm::dot(d, d), inv = fastRsqrt(d2);
+		L = d * inv;
+		lightDist = d2 * inv;
+		return;
+	}
+	L = glm::normalize(lightPos - hitPoint);
+	lightDist = glm::length(lightPos - hitPoint);
+}
+
+inline float lightAttenuation(float lightDist, float intensity){
+	if(shadingMath == FastMath) return 1.0f + fastPow(lightDist / 32.0f, intensity);
+	return (1.0f + pow(lightDist / 32.0f, intensity));
+}
+
+inline float specularPower(float base, float exponent){
+	return shadingMath == FastMath ? fastPow(base, exponent) : powf(base, exponent);
+}
+
+// lightAttenuation and specularPower over arrays; the fast tier's vectorize.
+inline void lightPowers(size_t n, const float *lightDist, const float *intensity, const float *specularBase, const float *exponent,
+	float *attenuation, float *specular){
+	if(shadingMath == FastMath){
+		#pragma omp simd
+		for(size_t k = 0; k < n; k++){
+			attenuation[k] = 1.0f + fastPow(lightDist[k] / 32.0f, intensity[k]);
+			specular[k] = fastPow(specularBase[k], exponent[k]);
+		}
+		return;
+	}
+	for(size_t k = 0; k < n; k++){
+		attenuation[k] = lightAttenuation(lightDist[k], intensity[k]);
+		specular[k] = specularPower(specularBase[k], exponent[k]);
+	}
+}
+
+inline glm::vec3 sphereCheckered(Material &material, glm::vec3 normal){
+	if(shadingMath == ReferenceMath) return material.returnSphereCheckered(normal);
+	glm::vec2 uv = glm::vec2(fastAtan2(normal.x, normal.z) / (2.0f * glm::pi<float>()) + 0.5f, fastAsin(normal.y) / glm::pi<float>() + 0.5f);
+	return (int)(floor(16.0f * uv.x) + floor(10.0f * uv.y)) % 2 ? glm::vec3(0.9f) : material.color;
+}
+
+// primary, if given, is the ray's closest hit already found by rasterizePrimary.
+glm::vec3 cast_ray(Ray ray, const std::vector<Object*> &stuff, const std::vector<Light> &lights, PixelSampler &sampler, size_t depth = 0, GBufferSample *guide = nullptr,
+	const PrimaryHit *primary = nullptr) {
+	float numericalMinimum = 1e-3f;
+	glm::vec3 finalColor;
+	hitHistory rayHistory;
+	if(primary && primary->object >= 0){
+		Object *object = stuff[primary->object];
+		glm::vec3 hitPoint = ray.orig + ray.dir * primary->dist;
+		rayHistory = hitHistory(primary->dist, hitPoint, object->getNormal(hitPoint), object->material);
+		if(recordDependencies) recordDependencies->addHit(primary->object, ray.orig, hitPoint);
+	}
+	else if(primary){
+		if(recordDependencies) recordDependencies->addMiss();
+		return glm::vec3(0.0f, 0.0f, 0.0f);
+	}
+    else if (depth > 8 || !sceneIntersection(ray, stuff, rayHistory)) {
+        return glm::vec3(0.0f, 0.0f, 0.0f); // BG color!
+    }
+	if(recordDependencies){
+		recordDependencies->addVertex(depth, ray.orig);
+		recordDependencies->addVertex(depth + 1, rayHistory.hitPoint);
+	}
+	
+	glm::vec3 reflect_dir = glm::normalize(glm::reflect(ray.dir, rayHistory.normal));
+    glm::vec3 reflect_orig = glm::dot(reflect_dir, rayHistory.normal) < 0 ? rayHistory.hitPoint - rayHistory.normal * numericalMinimum : rayHistory.hitPoint + rayHistory.normal * numericalMinimum;
+    glm::vec3 reflect_color = cast_ray(Ray(reflect_orig, reflect_dir), stuff, lights, sampler, depth + 1);
+	
+	float totalDt = 0.0f, totalSpecular = 0.0f;
+	glm::vec3 lightColor;
+	for(size_t i = 0; i < lights.size(); i++){
+		if(recordDependencies) recordDependencies->addLight(i);
+		glm::vec3 L;
+		float lightDist;
+		towardsLight(lights[i].pos, rayHistory.hitPoint, L, lightDist);
+		float attenuation = lightAttenuation(lightDist, lights[i].intensity);
+		
+		float visibility = 1.0f;
+		if(previewShadows){
+			visibility = (*previewShadows)[i].visibility(rayHistory.hitPoint, rayHistory.normal, L);
+			if(visibility <= 0.0f) continue;
+		}
+		glm::vec3 shadowDir = L;
+		float shadowDist = lightDist;
+		if(lights[i].radius > 0.0f){
+			glm::vec3 target = lights[i].pos + sampleDisc(sampler.get2D(lightDimension(depth, i, lights.size())), L) * lights[i].radius;
+			shadowDir = glm::normalize(target - rayHistory.hitPoint);
+			shadowDist = glm::length(target - rayHistory.hitPoint);
+		}
+		Ray shadowRay(glm::dot(shadowDir,rayHistory.normal) < 0 ? rayHistory.hitPoint - rayHistory.normal * numericalMinimum : rayHistory.hitPoint + rayHistory.normal * numericalMinimum, shadowDir);
+		hitHistory shadowHist;
+		
+        if (!previewShadows && sceneIntersection(shadowRay, stuff, shadowHist) && glm::length(shadowHist.hitPoint - shadowRay.orig) < shadowDist){
+			continue;
+		}
+		
+		totalDt += (lights[i].intensity * std::max(0.f, glm::dot(L, rayHistory.normal))) / attenuation * visibility;
+		totalSpecular += (specularPower(std::max(0.0f, glm::dot(-glm::reflect(-L, rayHistory.normal), ray.dir)),rayHistory.obtMat->specualirity) * lights[i].intensity) / attenuation * visibility;
+			
+		lightColor += lights[i].color * attenuation * visibility;
+	}
+	glm::vec3 direct, reflected;
+	switch(rayHistory.obtMat->type){
+		case Reflective:
+			reflected = reflect_color * totalDt * rayHistory.obtMat->pbrCtrl.z * lightColor;
+			break;
+		case Checkered:
+			direct = rayHistory.obtMat->returnCheckered(rayHistory.hitPoint) * totalDt *
+						rayHistory.obtMat->pbrCtrl.x + glm::vec3(1.0f) * 
+						std::floor(totalSpecular) * 
+						rayHistory.obtMat->pbrCtrl.y * lightColor;
+			reflected = reflect_color * rayHistory.obtMat->pbrCtrl.z;
+			break;
+		case SphereCheckered:
+			direct = sphereCheckered(*rayHistory.obtMat, rayHistory.normal) * totalDt *
+						rayHistory.obtMat->pbrCtrl.x + glm::vec3(1.0f) * 
+						std::floor(totalSpecular) * 
+						rayHistory.obtMat->pbrCtrl.y * lightColor;
+			reflected = reflect_color * rayHistory.obtMat->pbrCtrl.z;
+			break;
+		default:
+			direct = rayHistory.obtMat->color * totalDt * 
+						rayHistory.obtMat->pbrCtrl.x + glm::vec3(1.0f) * 
+						std::floor(totalSpecular) * 
+						rayHistory.obtMat->pbrCtrl.y * lightColor;
+			break;
+	}
+	finalColor = direct + reflected;
+	if(guide){
+		guide->normal = rayHistory.normal;
+		guide->depth = rayHistory.dist;
+		guide->materialID = rayHistory.obtMat->id;
+		guide->direct = direct;
+		guide->reflected = reflected;
+		switch(rayHistory.obtMat->type){
+			case Checkered: guide->albedo = rayHistory.obtMat->returnCheckered(rayHistory.hitPoint); break;
+			case SphereCheckered: guide->albedo = sphereCheckered(*rayHistory.obtMat, rayHistory.normal); break;
+			default: guide->albedo = rayHistory.obtMat->color; break;
+		}
+	}
+	return clampRay(finalColor);
+}
@@ -0,0 +1,411 @@
+// Wavefront (stream) integrator. Rather than following one path depth-first
+// like cast_ray, it keeps every path of a tile in flight and runs each stage
+// over the whole queue: extend (closest hit), shade, shadow, then spawn the
+// reflection rays of the paths that are still alive. Dead paths simply don't
+// make it into the next queue.
+//
+// cast_ray clamps at every bounce, so a path can't be summed front to back.
+// Each bounce stores its vertex and the chain is resolved back to front
+// once the path ends, which gives the same result as the recursion.
+
+// Rays in structure-of-arrays form, along with the closest hit found so far.
+struct RayQueue{
+	std::vector<float> ox, oy, oz, dx, dy, dz, dist;
+	std::vector<int> path, object;
+
+	size_t size() const{ return path.size(); }
+	void clear(){
+		for(auto *v : {&ox, &oy, &oz, &dx, &dy, &dz, &dist}) v->clear();
+		path.clear();
+		object.clear();
+	}
+	void push(const Ray &ray, int owner){
+		ox.push_back(ray.orig.x); oy.push_back(ray.orig.y); oz.push_back(ray.orig.z);
+		dx.push_back(ray.dir.x); dy.push_back(ray.dir.y); dz.push_back(ray.dir.z);
+		dist.push_back(std::numeric_limits<float>::max());
+		path.push_back(owner);
+		object.push_back(-1);
+	}
+	Ray ray(size_t i) const{
+		return Ray(glm::vec3(ox[i], oy[i], oz[i]), glm::vec3(dx[i], dy[i], dz[i]));
+	}
+};
+
+// Same tests as Sphere::intersect and Plane::intersect, run over a whole queue.
+inline void intersectSpheres(const Sphere &sphere, int index, RayQueue &q){
+	const int n = (int)q.size();
+	const float cx = sphere.pos.x, cy = sphere.pos.y, cz = sphere.pos.z, r2 = sphere.radius * sphere.radius;
+	const float *ox = q.ox.data(), *oy = q.oy.data(), *oz = q.oz.data();
+	const float *dx = q.dx.data(), *dy = q.dy.data(), *dz = q.dz.data();
+	float *dist = q.dist.data();
+	int *object = q.object.data();
+	#pragma omp simd
+	for(int i = 0; i < n; i++){
+		float lx = cx - ox[i], ly = cy - oy[i], lz = cz - oz[i];
+		float tca = lx * dx[i] + ly * dy[i] + lz * dz[i];
+		float d2 = (lx * lx + ly * ly + lz * lz) - tca * tca;
+		float rest = r2 - d2;
+		float thc = std::sqrt(rest > 0.0f ? rest : 0.0f);
+		float t0 = tca - thc, t1 = tca + thc;
+		float t = t0 < 0.0f ? t1 : t0;
+		bool hit = (d2 <= r2) & (t >= 0.0f) & (t < dist[i]);
+		dist[i] = hit ? t : dist[i];
+		object[i] = hit ? index : object[i];
+	}
+}
+
+inline void intersectPlanes(const Plane &plane, int index, RayQueue &q){
+	const int n = (int)q.size();
+	const float px = plane.pos.x, py = plane.pos.y, pz = plane.pos.z;
+	const float nx = plane.normal.x, ny = plane.normal.y, nz = plane.normal.z;
+	const float *ox = q.ox.data(), *oy = q.oy.data(), *oz = q.oz.data();
+	const float *dx = q.dx.data(), *dy = q.dy.data(), *dz = q.dz.data();
+	float *dist = q.dist.data();
+	int *object = q.object.data();
+	#pragma omp simd
+	for(int i = 0; i < n; i++){
+		float denom = nx * dx[i] + ny * dy[i] + nz * dz[i];
+		float t = ((px - ox[i]) * nx + (py - oy[i]) * ny + (pz - oz[i]) * nz) / denom;
+		bool hit = (std::fabs(denom) > 1e-6f) & (t >= 1e-6f) & (t < dist[i]);
+		dist[i] = hit ? t : dist[i];
+		object[i] = hit ? index : object[i];
+	}
+}
+
+// Ray reordering. Rays are keyed by direction octant, then by the cell of
+// their origin on an 8x8x8 grid over the queue's origin bounds (Morton order
+// within the octant), and counting sorted. Rays that end up next to each other
+// start close together and head the same way, so they touch the same objects.
+const int reorderCellBits = 3, reorderKeys = 8 << (3 * reorderCellBits);
+
+inline uint32_t spreadBits3(uint32_t v){
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+// Fills sorted with the rays of q in binned order; order[k] is the index in q
+// of sorted ray k. Stable, so the result doesn't depend on anything but q.
+inline void reorderRays(const RayQueue &q, RayQueue &sorted, std::vector<int> &order){
+	const int n = (int)q.size(), cells = 1 << reorderCellBits;
+	glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+	for(int i = 0; i < n; i++){
+		glm::vec3 o(q.ox[i], q.oy[i], q.oz[i]);
+		lo = glm::min(lo, o);
+		hi = glm::max(hi, o);
+	}
+	glm::vec3 scale = glm::vec3(float(cells)) / glm::max(hi - lo, glm::vec3(1e-6f));
+
+	std::vector<uint32_t> keys(n);
+	std::vector<int> start(reorderKeys + 1, 0);
+	for(int i = 0; i < n; i++){
+		uint32_t octant = (q.dx[i] < 0.0f) | ((q.dy[i] < 0.0f) << 1) | ((q.dz[i] < 0.0f) << 2);
+		uint32_t cx = std::min(int((q.ox[i] - lo.x) * scale.x), cells - 1);
+		uint32_t cy = std::min(int((q.oy[i] - lo.y) * scale.y), cells - 1);
+		uint32_t cz = std::min(int((q.oz[i] - lo.z) * scale.z), cells - 1);
+		keys[i] = (octant << (3 * reorderCellBits)) | spreadBits3(cx) | (spreadBits3(cy) << 1) | (spreadBits3(cz) << 2);
+		start[keys[i] + 1]++;
+	}
+	for(int k = 0; k < reorderKeys; k++) start[k + 1] += start[k];
+	order.resize(n);
+	for(int i = 0; i < n; i++) order[start[keys[i]]++] = i;
+
+	for(auto *v : {&sorted.ox, &sorted.oy, &sorted.oz, &sorted.dx, &sorted.dy, &sorted.dz, &sorted.dist}) v->resize(n);
+	sorted.path.resize(n);
+	sorted.object.resize(n);
+	for(int k = 0; k < n; k++){
+		int i = order[k];
+		sorted.ox[k] = q.ox[i]; sorted.oy[k] = q.oy[i]; sorted.oz[k] = q.oz[i];
+		sorted.dx[k] = q.dx[i]; sorted.dy[k] = q.dy[i]; sorted.dz[k] = q.dz[i];
+		sorted.dist[k] = q.dist[i];
+		sorted.path[k] = q.path[i];
+		sorted.object[k] = q.object[i];
+	}
+}
+
+// Per bounce ray counts and time spent in extend (including reordering),
+// summed over all tiles and threads.
+struct WavefrontStats{
+	std::atomic<uint64_t> rays[maxTraceDepth + 1], shadowRays[maxTraceDepth + 1], nanoseconds[maxTraceDepth + 1];
+
+	WavefrontStats(){
+		for(size_t d = 0; d <= maxTraceDepth; d++){
+			rays[d] = 0; shadowRays[d] = 0; nanoseconds[d] = 0;
+		}
+	}
+	void add(size_t depth, size_t rayCount, size_t shadowCount, std::chrono::steady_clock::duration time){
+		rays[depth] += rayCount;
+		shadowRays[depth] += shadowCount;
+		nanoseconds[depth] += std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+	}
+};
+
+struct WavefrontIntegrator{
+	const std::vector<Object*> &stuff;
+	const std::vector<Light> &lights;
+	std::vector<Sphere*> spheres;
+	std::vector<Plane*> planes;
+	uint32_t reorderMask = 0; // bit d: reorder the rays traced at bounce d and their shadow rays
+	WavefrontStats *stats = nullptr; // shared between integrators, may be null
+	const BVH *bvh = nullptr; // over stuff, if the render has one
+
+	WavefrontIntegrator(const std::vector<Object*> &s, const std::vector<Light> &l) : stuff(s), lights(l) {
+		for(auto &object : stuff){
+			spheres.push_back(dynamic_cast<Sphere*>(object));
+			planes.push_back(dynamic_cast<Plane*>(object));
+		}
+	}
+
+	// Objects in scene order, so ties resolve like sceneIntersection.
+	void extend(RayQueue &q) const{
+		raysTraced += q.size();
+		if(bvh){
+			// Unbounded objects over the whole queue, then one walk per ray.
+			for(int o : bvh->unbounded){
+				if(spheres[o]) intersectSpheres(*spheres[o], o, q);
+				else if(planes[o]) intersectPlanes(*planes[o], o, q);
+			}
+			for(size_t i = 0; i < q.size(); i++) bvh->intersect(q.ray(i), q.dist[i], q.object[i]);
+		}
+		else
+			for(size_t o = 0; o < stuff.size(); o++){
+				if(spheres[o]) intersectSpheres(*spheres[o], (int)o, q);
+				else if(planes[o]) intersectPlanes(*planes[o], (int)o, q);
+			}
+		record(q);
+	}
+
+	void record(const RayQueue &q) const{
+		if(recordDependencies)
+			for(size_t i = 0; i < q.size(); i++){
+				if(q.object[i] < 0) recordDependencies->addMiss();
+				else recordDependencies->addHit(q.object[i], q.ray(i).orig, q.ray(i).orig + q.ray(i).dir * q.dist[i]);
+			}
+	}
+
+	// Shadow rays are matched to their hit and light by index, so they are put
+	// back in queue order once intersected.
+	void extendReordered(RayQueue &q, RayQueue &sorted, std::vector<int> &order, bool restoreOrder) const{
+		reorderRays(q, sorted, order);
+		extend(sorted);
+		if(!restoreOrder){
+			std::swap(q, sorted);
+			return;
+		}
+		for(size_t k = 0; k < order.size(); k++){
+			q.dist[order[k]] = sorted.dist[k];
+			q.object[order[k]] = sorted.object[k];
+		}
+	}
+
+	hitHistory hitFor(const RayQueue &q, size_t i) const{
+		Object *object = stuff[q.object[i]];
+		glm::vec3 hitPoint = q.ray(i).orig + q.ray(i).dir * q.dist[i];
+		return hitHistory(q.dist[i], hitPoint, object->getNormal(hitPoint), object->material);
+	}
+
+	struct HitLighting{
+		float totalDt = 0.0f, totalSpecular = 0.0f;
+		glm::vec3 lightColor;
+	};
+
+	// Terms of every (hit, light) pair of the light loop, as arrays so that
+	// the pows run over all of them in one go.
+	struct LightTerms{
+		std::vector<glm::vec3> L;
+		std::vector<float> dist, visibility, intensity, specularBase, exponent, attenuation, specular;
+		void resize(size_t n){
+			L.resize(n);
+			for(auto *v : {&dist, &visibility, &intensity, &specularBase, &exponent, &attenuation, &specular}) v->resize(n);
+		}
+	};
+
+	struct ShadeContext{
+		const std::vector<hitHistory> &hits;
+		const std::vector<int> &bin;
+		const RayQueue &alive;
+		const std::vector<HitLighting> &lighting;
+		std::vector<PathVertex> &vertices;
+		std::vector<int> &pathLength;
+		RayQueue &next;
+		std::vector<GBufferSample> *guides;
+		size_t depth;
+	};
+
+	template<MaterialType Type> void shadeBin(ShadeContext &ctx) const{
+		const float numericalMinimum = 1e-3f;
+		const size_t n = ctx.bin.size();
+		ShadeScratch scratch;
+		scratch.resize(n);
+		std::vector<glm::vec3> albedo(n);
+		SurfaceKernel<Type>::albedo(ctx.hits, ctx.bin, scratch, albedo);
+
+		for(size_t b = 0; b < n; b++){
+			const int h = ctx.bin[b];
+			const hitHistory &hit = ctx.hits[h];
+			const HitLighting &lit = ctx.lighting[h];
+			const Material &mat = *hit.obtMat;
+			const int p = ctx.alive.path[h];
+			PathVertex &v = ctx.vertices[p * (maxTraceDepth + 1) + ctx.depth];
+			glm::vec3 specular = glm::vec3(1.0f) * std::floor(lit.totalSpecular) * mat.pbrCtrl.y * lit.lightColor;
+			SurfaceKernel<Type>::vertex(v, mat, albedo[b], lit.totalDt, specular, lit.lightColor);
+			ctx.pathLength[p] = ctx.depth + 1;
+
+			if(ctx.depth == 0 && ctx.guides){
+				GBufferSample &g = (*ctx.guides)[p];
+				g.normal = hit.normal;
+				g.depth = hit.dist;
+				g.materialID = mat.id;
+				g.direct = v.direct;
+				g.albedo = albedo[b];
+			}
+
+			// Diffuse ignores what it would reflect, so its path ends here.
+			if(v.k1 != 0.0f && ctx.depth < maxTraceDepth){
+				const Ray ray = ctx.alive.ray(h);
+				glm::vec3 reflect_dir = glm::normalize(glm::reflect(ray.dir, hit.normal));
+				glm::vec3 reflect_orig = glm::dot(reflect_dir, hit.normal) < 0 ? hit.hitPoint - hit.normal * numericalMinimum : hit.hitPoint + hit.normal * numericalMinimum;
+				ctx.next.push(Ray(reflect_orig, reflect_dir), p);
+			}
+		}
+	}
+
+	// Traces every ray of the batch. samplers[k] belongs to ray k, results go
+	// to colors[k] (and guides[k] when given). primary, if given, holds the
+	// rays' closest hits already, from rasterizePrimary.
+	void trace(const RayBatch &batch, std::vector<PixelSampler> &samplers, std::vector<glm::vec3> &colors, std::vector<GBufferSample> *guides,
+		const std::vector<PrimaryHit> *primary = nullptr) const{
+		const float numericalMinimum = 1e-3f;
+		const size_t n = batch.size(), lightCount = lights.size();
+		std::vector<PathVertex> vertices(n * (maxTraceDepth + 1));
+		std::vector<int> pathLength(n, 0);
+
+		RayQueue current, next, shadow, sorted;
+		std::vector<int> order;
+		std::vector<float> shadowDist;
+		std::vector<hitHistory> hits;
+		std::vector<HitLighting> lighting;
+		LightTerms terms;
+		std::vector<int> bins[MaterialTypeCount];
+		for(size_t k = 0; k < n; k++)
+			current.push(batch.ray(k), (int)k);
+
+		for(size_t depth = 0; depth <= maxTraceDepth && current.size(); depth++){
+			const bool reorder = reorderMask >> depth & 1;
+			auto extendStart = std::chrono::steady_clock::now();
+			if(depth == 0 && primary){
+				for(size_t i = 0; i < current.size(); i++){
+					current.object[i] = (*primary)[i].object;
+					current.dist[i] = (*primary)[i].dist;
+				}
+				record(current);
+			}
+			else if(reorder) extendReordered(current, sorted, order, false);
+			else extend(current);
+			auto extendTime = std::chrono::steady_clock::now() - extendStart;
+
+			// Compact: only rays that hit something carry on to shading.
+			hits.clear();
+			RayQueue alive;
+			for(size_t i = 0; i < current.size(); i++){
+				if(current.object[i] < 0) continue;
+				hits.push_back(hitFor(current, i));
+				alive.push(current.ray(i), current.path[i]);
+			}
+
+			// With shadow maps there are no shadow rays to trace.
+			shadow.clear();
+			shadowDist.clear();
+			for(size_t h = 0; h < hits.size() && !previewShadows; h++){
+				const hitHistory &hit = hits[h];
+				PixelSampler &sampler = samplers[alive.path[h]];
+				for(size_t i = 0; i < lightCount; i++){
+					glm::vec3 L;
+					float distance;
+					towardsLight(lights[i].pos, hit.hitPoint, L, distance);
+					glm::vec3 shadowDir = L;
+					if(lights[i].radius > 0.0f){
+						glm::vec3 target = lights[i].pos + sampleDisc(sampler.get2D(lightDimension(depth, i, lightCount)), L) * lights[i].radius;
+						shadowDir = glm::normalize(target - hit.hitPoint);
+						distance = glm::length(target - hit.hitPoint);
+					}
+					shadow.push(Ray(glm::dot(shadowDir, hit.normal) < 0 ? hit.hitPoint - hit.normal * numericalMinimum : hit.hitPoint + hit.normal * numericalMinimum, shadowDir), (int)h);
+					shadowDist.push_back(distance);
+				}
+			}
+			extendStart = std::chrono::steady_clock::now();
+			if(reorder) extendReordered(shadow, sorted, order, true);
+			else extend(shadow);
+			if(stats) stats->add(depth, current.size(), shadow.size(), extendTime + (std::chrono::steady_clock::now() - extendStart));
+
+			// Light loop, in light order like cast_ray so the sums round the same way.
+			lighting.resize(hits.size());
+			terms.resize(hits.size() * lightCount);
+			for(size_t h = 0; h < hits.size(); h++){
+				const hitHistory &hit = hits[h];
+				const Ray ray = alive.ray(h);
+				for(size_t i = 0; i < lightCount; i++){
+					const size_t s = h * lightCount + i;
+					if(recordDependencies) recordDependencies->addLight(i);
+					glm::vec3 &L = terms.L[s];
+					towardsLight(lights[i].pos, hit.hitPoint, L, terms.dist[s]);
+					float &visibility = terms.visibility[s];
+					visibility = 1.0f;
+					if(previewShadows)
+						visibility = (*previewShadows)[i].visibility(hit.hitPoint, hit.normal, L);
+					else if(shadow.object[s] >= 0){
+						glm::vec3 shadowPoint = shadow.ray(s).orig + shadow.ray(s).dir * shadow.dist[s];
+						if(glm::length(shadowPoint - shadow.ray(s).orig) < shadowDist[s]) visibility = 0.0f;
+					}
+					terms.intensity[s] = lights[i].intensity;
+					terms.specularBase[s] = std::max(0.0f, glm::dot(-glm::reflect(-L, hit.normal), ray.dir));
+					terms.exponent[s] = hit.obtMat->specualirity;
+				}
+			}
+			lightPowers(terms.dist.size(), terms.dist.data(), terms.intensity.data(), terms.specularBase.data(), terms.exponent.data(),
+				terms.attenuation.data(), terms.specular.data());
+			for(size_t h = 0; h < hits.size(); h++){
+				const hitHistory &hit = hits[h];
+				HitLighting &lit = lighting[h];
+				lit = HitLighting();
+				for(size_t i = 0; i < lightCount; i++){
+					const size_t s = h * lightCount + i;
+					const float visibility = terms.visibility[s], attenuation = terms.attenuation[s];
+					if(visibility <= 0.0f) continue;
+					lit.totalDt += (lights[i].intensity * std::max(0.f, glm::dot(terms.L[s], hit.normal))) / attenuation * visibility;
+					lit.totalSpecular += (terms.specular[s] * lights[i].intensity) / attenuation * visibility;
+					lit.lightColor += lights[i].color * attenuation * visibility;
+				}
+			}
+
+			// Bin by material type and run each bin through its own kernel.
+			for(auto &bin : bins) bin.clear();
+			for(size_t h = 0; h < hits.size(); h++)
+				bins[hits[h].obtMat->type].push_back((int)h);
+			next.clear();
+			for(int type = 0; type < MaterialTypeCount; type++){
+				if(bins[type].empty()) continue;
+				ShadeContext ctx{hits, bins[type], alive, lighting, vertices, pathLength, next, guides, depth};
+				switch(type){
+					case Reflective: shadeBin<Reflective>(ctx); break;
+					case Checkered: shadeBin<Checkered>(ctx); break;
+					case SphereCheckered: shadeBin<SphereCheckered>(ctx); break;
+					default: shadeBin<Diffuse>(ctx); break;
+				}
+			}
+			std::swap(current, next);
+		}
+
+		for(size_t p = 0; p < n; p++){
+			glm::vec3 color;
+			for(int d = pathLength[p] - 1; d >= 0; d--){
+				const PathVertex &v = vertices[p * (maxTraceDepth + 1) + d];
+				glm::vec3 reflected = color * v.k1 * v.k2 * v.tint;
+				if(d == 0 && guides) (*guides)[p].reflected = reflected;
+				color = clampRay(v.direct + reflected);
+			}
+			colors[p] = color;
+		}
+	}
+};